@@ -0,0 +1,405 @@
+#include <cctype>
+#include <cstring>
+
+#include "arithmetic.hh"
+#include "variables.hh"
+
+// operators are stored as up to two characters packed into an int
+static constexpr int op2(char first, char second = 0) {
+    return (unsigned char) first | ((unsigned char) second << 8);
+}
+
+// binary operators, longest first; a higher level binds tighter
+static const struct {
+    const char *text;
+    int level;
+} binaries[] = {
+    {"**", 12}, {"<<", 9}, {">>", 9}, {"<=", 8}, {">=", 8}, {"==", 7}, {"!=", 7},
+    {"&&", 3}, {"||", 2},
+    {"*", 11}, {"/", 11}, {"%", 11}, {"+", 10}, {"-", 10}, {"<", 8}, {">", 8},
+    {"&", 6}, {"^", 5}, {"|", 4},
+};
+
+// operators that also have an "op=" assignment form
+static const char *compound[] = {"<<", ">>", "*", "/", "%", "+", "-", "&", "^", "|"};
+
+namespace {
+
+struct Parser {
+    const std::string &text;
+    size_t pos;
+    Arithmetic &out;
+
+    void fail(const std::string &message) {
+        if (out._error.empty()) {
+            out._error = message + " (error token is \"" + text.substr(pos) + "\")";
+        }
+    }
+
+    void skipSpace() {
+        while (pos < text.size() && isspace((unsigned char) text[pos])) {
+            pos++;
+        }
+    }
+
+    bool at(const char *op) {
+        skipSpace();
+        return text.compare(pos, strlen(op), op) == 0;
+    }
+
+    bool accept(const char *op) {
+        if (!at(op)) {
+            return false;
+        }
+        pos += strlen(op);
+        return true;
+    }
+
+    int add(Arithmetic::Kind kind, int op, int a, int b = -1, int c = -1) {
+        Arithmetic::Node node;
+        node.kind = kind;
+        node.op = op;
+        node.value = 0;
+        node.postfix = false;
+        node.a = a;
+        node.b = b;
+        node.c = c;
+        out._nodes.push_back(node);
+        return (int) out._nodes.size() - 1;
+    }
+
+    // a variable name, with or without a leading $
+    bool name(std::string &result) {
+        skipSpace();
+        size_t start = pos;
+        if (pos < text.size() && text[pos] == '$') {
+            pos++;
+        }
+        if (pos >= text.size() || !(isalpha((unsigned char) text[pos]) || text[pos] == '_')) {
+            pos = start;
+            return false;
+        }
+        size_t first = pos;
+        while (pos < text.size() && (isalnum((unsigned char) text[pos]) || text[pos] == '_')) {
+            pos++;
+        }
+        result = text.substr(first, pos - first);
+        return true;
+    }
+
+    // 255, 0xff, 0377, 16#ff
+    int number() {
+        const char *start = text.c_str() + pos;
+        char *end;
+        long long value = (long long) strtoull(start, &end, 0);
+        if (*end == '#') {
+            int base = (int) value;
+            if (base < 2 || base > 36) {
+                fail("invalid arithmetic base");
+                return -1;
+            }
+            value = (long long) strtoull(end + 1, &end, base);
+        }
+        if (isalnum((unsigned char) *end) || *end == '_') {
+            fail("value too great for base");
+            return -1;
+        }
+        pos += end - start;
+        int node = add(Arithmetic::NUMBER, 0, -1);
+        out._nodes[node].value = value;
+        return node;
+    }
+
+    int primary() {
+        skipSpace();
+        if (accept("(")) {
+            int inner = comma();
+            if (!accept(")")) {
+                fail("missing `)'");
+            }
+            return inner;
+        }
+        if (pos < text.size() && isdigit((unsigned char) text[pos])) {
+            return number();
+        }
+        std::string variable;
+        if (!name(variable)) {
+            fail("syntax error: operand expected");
+            return -1;
+        }
+        for (const char *step : {"++", "--"}) {
+            if (accept(step)) {
+                int node = add(Arithmetic::INCREMENT, 0, -1);
+                out._nodes[node].value = step[0] == '+' ? 1 : -1;
+                out._nodes[node].postfix = true;
+                out._nodes[node].name = variable;
+                out._assigns = true;
+                return node;
+            }
+        }
+        int node = add(Arithmetic::VARIABLE, 0, -1);
+        out._nodes[node].name = variable;
+        return node;
+    }
+
+    int unary() {
+        for (const char *step : {"++", "--"}) {
+            size_t saved = pos;
+            std::string variable;
+            if (accept(step) && name(variable)) {
+                int node = add(Arithmetic::INCREMENT, 0, -1);
+                out._nodes[node].value = step[0] == '+' ? 1 : -1;
+                out._nodes[node].name = variable;
+                out._assigns = true;
+                return node;
+            }
+            pos = saved;
+        }
+        for (const char *op : {"-", "+", "!", "~"}) {
+            if (accept(op)) {
+                return add(Arithmetic::UNARY, op[0], unary());
+            }
+        }
+        return primary();
+    }
+
+    // the binary operator at pos, unless it is really an op= assignment
+    const char *binary(int &level) {
+        skipSpace();
+        for (auto &entry : binaries) {
+            size_t length = strlen(entry.text);
+            if (text.compare(pos, length, entry.text) != 0) {
+                continue;
+            }
+            if (pos + length < text.size() && text[pos + length] == '=') {
+                for (const char *op : compound) {
+                    if (strcmp(op, entry.text) == 0) {
+                        return NULL;
+                    }
+                }
+            }
+            level = entry.level;
+            return entry.text;
+        }
+        return NULL;
+    }
+
+    // precedence climbing over the binary operators; ** is right-associative
+    int climb(int minLevel) {
+        int left = unary();
+        int level;
+        const char *op;
+        while (out._error.empty() && (op = binary(level)) != NULL && level >= minLevel) {
+            pos += strlen(op);
+            int right = climb(strcmp(op, "**") == 0 ? level : level + 1);
+            if (strcmp(op, "&&") == 0) {
+                left = add(Arithmetic::AND, 0, left, right);
+            } else if (strcmp(op, "||") == 0) {
+                left = add(Arithmetic::OR, 0, left, right);
+            } else {
+                left = add(Arithmetic::BINARY, op2(op[0], op[1]), left, right);
+            }
+        }
+        return left;
+    }
+
+    int ternary() {
+        int condition = climb(2);
+        if (!accept("?")) {
+            return condition;
+        }
+        int whenTrue = assignment();
+        if (!accept(":")) {
+            fail("`:' expected for conditional expression");
+            return -1;
+        }
+        int whenFalse = assignment();
+        return add(Arithmetic::TERNARY, 0, condition, whenTrue, whenFalse);
+    }
+
+    int assignment() {
+        size_t saved = pos;
+        std::string variable;
+        if (name(variable)) {
+            skipSpace();
+            int op = -1;
+            if (at("=") && !at("==")) {
+                op = 0;
+                pos += 1;
+            } else {
+                for (const char *candidate : compound) {
+                    size_t length = strlen(candidate);
+                    if (text.compare(pos, length, candidate) == 0 && pos + length < text.size() &&
+                        text[pos + length] == '=') {
+                        op = op2(candidate[0], candidate[1]);
+                        pos += length + 1;
+                        break;
+                    }
+                }
+            }
+            if (op >= 0) {
+                int node = add(Arithmetic::ASSIGN, op, assignment());
+                out._nodes[node].name = variable;
+                out._assigns = true;
+                return node;
+            }
+        }
+        pos = saved;
+        return ternary();
+    }
+
+    int comma() {
+        int left = assignment();
+        while (out._error.empty() && accept(",")) {
+            left = add(Arithmetic::COMMA, 0, left, assignment());
+        }
+        return left;
+    }
+};
+
+}  // namespace
+
+Arithmetic Arithmetic::compile(const std::string &text) {
+    Arithmetic result;
+    Parser parser{text, 0, result};
+    parser.skipSpace();
+    if (parser.pos == text.size()) {
+        // $(( )) is 0
+        result._root = parser.add(NUMBER, 0, -1);
+        return result;
+    }
+    result._root = parser.comma();
+    parser.skipSpace();
+    if (result._error.empty() && parser.pos < text.size()) {
+        parser.fail("syntax error in expression");
+    }
+    return result;
+}
+
+// 64-bit two's complement arithmetic: overflow wraps instead of being undefined
+static bool apply(int op, long long a, long long b, long long &r, std::string &error) {
+    unsigned long long ua = (unsigned long long) a, ub = (unsigned long long) b;
+    switch (op) {
+    case op2('+'): r = (long long) (ua + ub); break;
+    case op2('-'): r = (long long) (ua - ub); break;
+    case op2('*'): r = (long long) (ua * ub); break;
+    case op2('/'):
+    case op2('%'):
+        if (b == 0) {
+            error = "division by 0";
+            return false;
+        }
+        if (b == -1) {
+            // LLONG_MIN / -1 would trap
+            r = op == op2('/') ? (long long) (0 - ua) : 0;
+        } else {
+            r = op == op2('/') ? a / b : a % b;
+        }
+        break;
+    case op2('*', '*'): {
+        if (b < 0) {
+            error = "exponent less than 0";
+            return false;
+        }
+        unsigned long long power = 1;
+        for (unsigned long long base = ua; b > 0; b >>= 1, base *= base) {
+            if (b & 1) {
+                power *= base;
+            }
+        }
+        r = (long long) power;
+        break;
+    }
+    case op2('<', '<'): r = (long long) (ua << (ub & 63)); break;
+    case op2('>', '>'): r = a >> (ub & 63); break;
+    case op2('<'): r = a < b; break;
+    case op2('<', '='): r = a <= b; break;
+    case op2('>'): r = a > b; break;
+    case op2('>', '='): r = a >= b; break;
+    case op2('=', '='): r = a == b; break;
+    case op2('!', '='): r = a != b; break;
+    case op2('&'): r = a & b; break;
+    case op2('^'): r = a ^ b; break;
+    case op2('|'): r = a | b; break;
+    default:
+        error = "unknown operator";
+        return false;
+    }
+    return true;
+}
+
+bool Arithmetic::evaluate(long long &result, std::string &error) const {
+    if (!_error.empty()) {
+        error = _error;
+        return false;
+    }
+    return evaluate(_root, result, error);
+}
+
+bool Arithmetic::evaluate(int index, long long &result, std::string &error) const {
+    const Node &node = _nodes[index];
+    long long a, b;
+    switch (node.kind) {
+    case NUMBER:
+        result = node.value;
+        return true;
+    case VARIABLE:
+        return Variables::integer(node.name, result, error);
+    case UNARY:
+        if (!evaluate(node.a, a, error)) {
+            return false;
+        }
+        switch (node.op) {
+        case '-': result = (long long) (0 - (unsigned long long) a); break;
+        case '!': result = !a; break;
+        case '~': result = ~a; break;
+        default: result = a; break;
+        }
+        return true;
+    case BINARY:
+        return evaluate(node.a, a, error) && evaluate(node.b, b, error) &&
+               apply(node.op, a, b, result, error);
+    case AND:
+    case OR:
+        if (!evaluate(node.a, a, error)) {
+            return false;
+        }
+        if ((node.kind == AND) == (a == 0)) {
+            result = node.kind == OR;
+            return true;
+        }
+        if (!evaluate(node.b, b, error)) {
+            return false;
+        }
+        result = b != 0;
+        return true;
+    case TERNARY:
+        if (!evaluate(node.a, a, error)) {
+            return false;
+        }
+        return evaluate(a ? node.b : node.c, result, error);
+    case ASSIGN:
+        if (!evaluate(node.a, b, error)) {
+            return false;
+        }
+        if (node.op != 0) {
+            if (!Variables::integer(node.name, a, error) || !apply(node.op, a, b, b, error)) {
+                return false;
+            }
+        }
+        Variables::setInteger(node.name, b);
+        result = b;
+        return true;
+    case INCREMENT:
+        if (!Variables::integer(node.name, a, error)) {
+            return false;
+        }
+        b = (long long) ((unsigned long long) a + (unsigned long long) node.value);
+        Variables::setInteger(node.name, b);
+        result = node.postfix ? a : b;
+        return true;
+    case COMMA:
+        return evaluate(node.a, a, error) && evaluate(node.b, result, error);
+    }
+    return false;
+}
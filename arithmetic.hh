@@ -0,0 +1,36 @@
+#ifndef arithmetic_hh
+#define arithmetic_hh
+
+#include <string>
+#include <vector>
+
+// $(( expr )) and (( expr )): 64-bit integer expressions with the C operators
+// (plus ** and the assignment forms), parsed once by precedence climbing into
+// a flat node list and evaluated against the shell's variables.
+
+struct Arithmetic {
+
+  enum Kind { NUMBER, VARIABLE, UNARY, BINARY, AND, OR, TERNARY, ASSIGN, INCREMENT, COMMA };
+
+  struct Node {
+    Kind kind;
+    int op;              // operator character(s), see arithmetic.cc
+    long long value;     // NUMBER; +1/-1 for INCREMENT
+    bool postfix;        // INCREMENT: x++ rather than ++x
+    std::string name;    // VARIABLE, ASSIGN, INCREMENT
+    int a, b, c;         // operands, -1 when unused
+  };
+
+  std::vector<Node> _nodes;
+  int _root = -1;
+  std::string _error;     // syntax error found while compiling
+  bool _assigns = false;  // has =, op= , ++ or --
+
+  static Arithmetic compile(const std::string &text);
+  bool evaluate(long long &result, std::string &error) const;
+
+private:
+  bool evaluate(int node, long long &result, std::string &error) const;
+};
+
+#endif
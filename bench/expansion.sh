@@ -0,0 +1,41 @@
+#!/bin/bash
+#
+# Word expansion microbenchmark: argument-heavy lines run by a builtin
+# (unsetenv expands every word and ignores the extra ones), so the time is
+# the shell's own parsing and expansion, with no fork or exec. With
+# bench/malloc-count.so built ("make bench"), allocations per line are
+# counted too: a run of the same script without the lines is subtracted.
+#
+#   bench/expansion.sh [shell] [lines]
+#
+
+shell=${1:-./shell}
+lines=${2:-5000}
+counter=$(dirname "$(realpath "$0")")/malloc-count.so
+
+script=$(mktemp)
+empty=$(mktemp)
+count=$(mktemp)
+trap 'rm -f "$script" "$empty" "$count"' EXIT
+{
+    echo 'setenv A alpha'
+    echo 'setenv B /usr/local/share'
+} > "$empty"
+{
+    cat "$empty"
+    for ((i = 0; i < lines; i++)); do
+        echo 'unsetenv Z plain words that need no expansion at all ${A} ${B}/x a${A}b${B}c ${A}${A}${A} more/literal/path -o file.out --flag=value'
+    done
+} > "$script"
+
+echo "expansion: $lines lines of 15 words"
+TIMEFORMAT="  %R s elapsed, %U s user"
+time "$shell" < "$script" > /dev/null
+
+if [ -f "$counter" ]; then
+    MALLOC_COUNT_FILE=$count LD_PRELOAD=$counter "$shell" < "$empty" > /dev/null
+    base=$(cat "$count")
+    MALLOC_COUNT_FILE=$count LD_PRELOAD=$counter "$shell" < "$script" > /dev/null
+    all=$(cat "$count")
+    echo "  $(( (all - base) / lines )) allocations per line"
+fi
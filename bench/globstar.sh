@@ -0,0 +1,44 @@
+#!/bin/bash
+#
+# ** scaling: expand **/*.c over a generated tree, once walked in the calling
+# thread (MYSHELL_GLOB_THREADS=1) and once on the thread pool.
+#
+#   bench/globstar.sh [shell] [depth] [fanout] [files per directory]
+#
+
+shell=$(realpath "${1:-./shell}")
+depth=${2:-4}
+fanout=${3:-8}
+files=${4:-20}
+
+tree=$(mktemp -d)
+script=$(mktemp)
+trap 'rm -rf "$tree" "$script"' EXIT
+
+# fanout^depth leaf directories, each level holding files of its own
+make_level() {
+    local dir=$1 level=$2 f d
+    for ((f = 0; f < files; f++)); do
+        : > "$dir/f$f.c"
+    done
+    : > "$dir/notes.txt"
+    if ((level < depth)); then
+        for ((d = 0; d < fanout; d++)); do
+            mkdir "$dir/d$d"
+            make_level "$dir/d$d" $((level + 1))
+        done
+    fi
+}
+make_level "$tree" 0
+entries=$(find "$tree" | wc -l)
+
+echo "globstar: $entries entries, depth $depth, fanout $fanout"
+for threads in 1 ""; do
+    {
+        [ -n "$threads" ] && echo "setenv MYSHELL_GLOB_THREADS $threads"
+        echo "cd $tree"
+        echo 'unsetenv Z **/*.c'
+    } > "$script"
+    TIMEFORMAT="  threads=${threads:-auto}: %R s elapsed, %U s user, %S s sys"
+    time "$shell" < "$script"
+done
@@ -0,0 +1,35 @@
+#!/bin/bash
+#
+# Here-document bodies (pipe when small, memfd when large) against the temp
+# file they replace: the same body written to a file and redirected with <.
+#
+#   bench/heredoc.sh [shell] [body size in KB] [repetitions]
+#
+
+shell=${1:-./shell}
+kb=${2:-1024}
+count=${3:-20}
+
+heredoc=$(mktemp)
+tempfile=$(mktemp)
+scratch=$(mktemp)
+trap 'rm -f "$heredoc" "$tempfile" "$scratch"' EXIT
+
+body=$(head -c $((kb << 10)) /dev/zero | tr '\0' x | fold -w 100)
+for ((i = 0; i < count; i++)); do
+    echo 'wc -c << EOF'
+    echo "$body"
+    echo 'EOF'
+done > "$heredoc"
+for ((i = 0; i < count; i++)); do
+    echo "cat > $scratch << EOF"
+    echo "$body"
+    echo 'EOF'
+    echo "wc -c < $scratch"
+done > "$tempfile"
+
+echo "heredoc: $count bodies of $kb KB"
+TIMEFORMAT="  here-document: %R s elapsed"
+time "$shell" < "$heredoc" > /dev/null
+TIMEFORMAT="  temp file:     %R s elapsed"
+time "$shell" < "$tempfile" > /dev/null
@@ -0,0 +1,46 @@
+/*
+ * LD_PRELOAD helper for bench/expansion.sh: counts the calls to malloc,
+ * calloc and realloc (operator new included) and writes the total to the
+ * file named by $MALLOC_COUNT_FILE when the process exits.
+ */
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+extern void *__libc_malloc(size_t size);
+extern void *__libc_calloc(size_t count, size_t size);
+extern void *__libc_realloc(void *pointer, size_t size);
+
+static unsigned long allocations;
+
+void *malloc(size_t size) {
+    allocations++;
+    return __libc_malloc(size);
+}
+
+void *calloc(size_t count, size_t size) {
+    allocations++;
+    return __libc_calloc(count, size);
+}
+
+void *realloc(void *pointer, size_t size) {
+    allocations++;
+    return __libc_realloc(pointer, size);
+}
+
+__attribute__((destructor)) static void report(void) {
+    const char *file = getenv("MALLOC_COUNT_FILE");
+    if (file == NULL) {
+        return;
+    }
+    char line[32];
+    int length = snprintf(line, sizeof(line), "%lu\n", allocations);
+    int fd = open(file, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd >= 0) {
+        write(fd, line, length);
+        close(fd);
+    }
+}
@@ -0,0 +1,25 @@
+#!/bin/bash
+#
+# $(...) capture: the output of a command substitution of growing size is
+# captured and scanned back as words. A linear capture keeps the time per
+# megabyte flat as the size grows.
+#
+#   bench/substitution.sh [shell] [sizes in MB...]
+#
+
+shell=${1:-./shell}
+shift
+sizes=("$@")
+if [ ${#sizes[@]} -eq 0 ]; then
+    sizes=(1 4 16)
+fi
+
+script=$(mktemp)
+trap 'rm -f "$script"' EXIT
+
+echo "substitution: unsetenv Z \$(...) with 8000-byte words"
+for mb in "${sizes[@]}"; do
+    echo "unsetenv Z \$(head -c $((mb << 20)) /dev/zero | tr '\\0' a | fold -w 8000)" > "$script"
+    TIMEFORMAT="  $mb MB: %R s elapsed"
+    time "$shell" < "$script"
+done
@@ -0,0 +1,206 @@
+#include <algorithm>
+#include <cctype>
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+
+#include "brace.hh"
+
+// index just past the } closing the { or ${ at text[start]; npos when unclosed
+static size_t closing(const std::string &text, size_t start) {
+    int depth = 0;
+    for (size_t i = start; i < text.size(); i++) {
+        if (text[i] == '{') {
+            depth++;
+        } else if (text[i] == '}' && --depth == 0) {
+            return i + 1;
+        }
+    }
+    return std::string::npos;
+}
+
+bool Brace::compile(const std::string &text, Brace &brace) {
+    if (text.find('{') == std::string::npos) {
+        return false;
+    }
+    parse(text, brace);
+    return brace._parts.size() > 1 || (brace._parts.size() == 1 && brace._parts[0].kind != Part::TEXT);
+}
+
+void Brace::addText(const std::string &text) {
+    if (text.empty()) {
+        return;
+    }
+    if (!_parts.empty() && _parts.back().kind == Part::TEXT) {
+        _parts.back().text += text;
+        return;
+    }
+    Part part;
+    part.kind = Part::TEXT;
+    part.text = text;
+    part.size = 1;
+    add(part);
+}
+
+// sizes multiply; past _maxWords the word is left alone by the caller
+void Brace::add(Part &part) {
+    if (part.size == 0 || _size > _maxWords / part.size) {
+        _size = _maxWords + 1;
+    } else {
+        _size *= part.size;
+    }
+    _parts.push_back(std::move(part));
+}
+
+// {x..y} and {x..y..step} over integers or single characters
+bool Brace::parseRange(const std::string &body, Part &part) {
+    size_t dots = body.find("..");
+    if (dots == std::string::npos || dots == 0) {
+        return false;
+    }
+    std::string from = body.substr(0, dots);
+    std::string to = body.substr(dots + 2);
+    long long step = 1;
+    size_t more = to.find("..");
+    if (more != std::string::npos) {
+        std::string by = to.substr(more + 2);
+        to.erase(more);
+        char *end;
+        errno = 0;
+        step = strtoll(by.c_str(), &end, 10);
+        if (by.empty() || *end != '\0' || errno == ERANGE) {
+            return false;
+        }
+    }
+    if (to.empty()) {
+        return false;
+    }
+
+    long long a, b;
+    part.width = 0;
+    if (from.size() == 1 && to.size() == 1 && !isdigit((unsigned char) from[0]) &&
+        !isdigit((unsigned char) to[0])) {
+        a = (unsigned char) from[0];
+        b = (unsigned char) to[0];
+        part.letters = true;
+    } else {
+        char *endA, *endB;
+        errno = 0;
+        a = strtoll(from.c_str(), &endA, 10);
+        b = strtoll(to.c_str(), &endB, 10);
+        if (*endA != '\0' || *endB != '\0' || errno == ERANGE) {
+            return false;
+        }
+        part.letters = false;
+        // {01..10}: either end written with a leading zero pads to the wider one
+        for (const std::string *end : {&from, &to}) {
+            size_t digit = (*end)[0] == '-' ? 1 : 0;
+            if (end->size() > digit + 1 && (*end)[digit] == '0') {
+                part.width = (int) std::max(from.size(), to.size());
+            }
+        }
+    }
+
+    unsigned long long distance = a <= b ? (unsigned long long) b - a : (unsigned long long) a - b;
+    unsigned long long by = step == 0 ? 1 : step < 0 ? 0 - (unsigned long long) step : step;
+    part.kind = Part::RANGE;
+    part.first = a;
+    part.step = (long long) (a <= b ? by : 0 - by);
+    part.size = distance / by + 1;
+    return true;
+}
+
+// Split text into literal parts and the brace expressions in it. A { without
+// a top-level comma or a valid range is literal, and so is ${name}.
+void Brace::parse(const std::string &text, Brace &brace) {
+    size_t literal = 0;
+    for (size_t i = 0; i < text.size(); i++) {
+        if (text[i] == '$' && i + 1 < text.size() && text[i + 1] == '{') {
+            size_t end = closing(text, i + 1);
+            if (end == std::string::npos) {
+                break;
+            }
+            i = end - 1;
+            continue;
+        }
+        if (text[i] != '{') {
+            continue;
+        }
+        size_t end = closing(text, i);
+        if (end == std::string::npos) {
+            break;
+        }
+
+        // top-level commas, skipping nested {...}
+        std::vector<size_t> commas;
+        int depth = 0;
+        for (size_t j = i + 1; j < end - 1; j++) {
+            if (text[j] == '{') {
+                depth++;
+            } else if (text[j] == '}') {
+                depth--;
+            } else if (text[j] == ',' && depth == 0) {
+                commas.push_back(j);
+            }
+        }
+
+        Part part;
+        if (!commas.empty()) {
+            part.kind = Part::ALTERNATIVES;
+            part.size = 0;
+            commas.push_back(end - 1);
+            size_t from = i + 1;
+            for (size_t comma : commas) {
+                Brace alternative;
+                parse(text.substr(from, comma - from), alternative);
+                part.size += alternative._size;
+                part.alternatives.push_back(std::move(alternative));
+                from = comma + 1;
+            }
+        } else if (!parseRange(text.substr(i + 1, end - i - 2), part)) {
+            continue;  // {} or {x}: literal, but braces inside it may still expand
+        }
+        brace.addText(text.substr(literal, i - literal));
+        brace.add(part);
+        literal = end;
+        i = end - 1;
+    }
+    brace.addText(text.substr(literal));
+}
+
+// Word number index: the first part varies slowest, as in a{b,c}{1,2} ->
+// ab1 ab2 ac1 ac2
+void Brace::generate(unsigned long long index, std::string &out) const {
+    unsigned long long below = _size;
+    for (const Part &part : _parts) {
+        below /= part.size;
+        unsigned long long k = index / below;
+        index %= below;
+        switch (part.kind) {
+        case Part::TEXT:
+            out += part.text;
+            break;
+        case Part::ALTERNATIVES:
+            for (const Brace &alternative : part.alternatives) {
+                if (k < alternative._size) {
+                    alternative.generate(k, out);
+                    break;
+                }
+                k -= alternative._size;
+            }
+            break;
+        case Part::RANGE: {
+            long long value = (long long) ((unsigned long long) part.first +
+                                           k * (unsigned long long) part.step);
+            if (part.letters) {
+                out += (char) value;
+            } else {
+                char digits[32];
+                snprintf(digits, sizeof(digits), "%0*lld", part.width, value);
+                out += digits;
+            }
+            break;
+        }
+        }
+    }
+}
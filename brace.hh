@@ -0,0 +1,42 @@
+#ifndef brace_hh
+#define brace_hh
+
+#include <string>
+#include <vector>
+
+// Brace expansion: a{b,c}d, {1..10}, {01..99..2}, {a..z}.
+// A word is compiled into parts once; the words it stands for are generated
+// one at a time by index when the command runs, so {1..100000} is stored as
+// a range and no intermediate lists are built for {a,b}{c,d}.
+
+struct Brace {
+
+  struct Part {
+    enum Kind { TEXT, ALTERNATIVES, RANGE };
+    Kind kind;
+    std::string text;                 // TEXT
+    std::vector<Brace> alternatives;  // ALTERNATIVES: {x,y,...}, each expanded in turn
+    long long first;                  // RANGE: first value, step and count
+    long long step;
+    int width;                        // RANGE: zero-padded width, 0 for none
+    bool letters;                     // RANGE: {a..z}
+    unsigned long long size;          // words this part stands for
+  };
+
+  std::vector<Part> _parts;
+  unsigned long long _size = 1;       // product of the parts' sizes
+
+  static const unsigned long long _maxWords = 1 << 22;
+
+  // false when text has no brace expression to expand
+  static bool compile(const std::string &text, Brace &brace);
+  void generate(unsigned long long index, std::string &out) const;
+
+private:
+  static void parse(const std::string &text, Brace &brace);
+  static bool parseRange(const std::string &body, Part &part);
+  void addText(const std::string &text);
+  void add(Part &part);
+};
+
+#endif
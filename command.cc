@@ -4,27 +4,66 @@
 #include <wait.h>       //waitpid系统调用
 #include <sys/types.h>  //pid_t
 #include <sys/stat.h>
+#include <sys/time.h>   // timeradd
+#include <sys/resource.h>
 #include <fcntl.h>
+#include <sys/mman.h>   // memfd_create
+#include <dirent.h>     // MYSHELL_FDTRACE
+#include <spawn.h>      // posix_spawnp
+#include <sched.h>      // sched_getaffinity
+#include <poll.h>
+#include <time.h>
+#include <algorithm>
+#include <cerrno>
+#include <cmath>
+#include <deque>
 #include <iostream>
 #include <cstring>
 #include <limits.h>     // PATH_MAX
-#include <sstream>      // stringstream
+#include <memory>       // shared_ptr
 #include <string>
+#include <condition_variable>
+#include <mutex>
+#include <thread>       // cat elision feeder
 #include <vector>
 
 #include "command.hh"
+#include "glob.hh"
+#include "jobs.hh"
+#include "pathCache.hh"
 #include "shell.hh"
+#include "variables.hh"
 #include "y.tab.hh"     // yyparse
 
 extern bool commandRunning;
-extern char **environ;  // global var: Environment variable
 extern int yyparse(void);
 extern FILE *yyin;      // Flex
 extern void myunputc(int c);  // for lex
+extern bool lexInputExhausted();  // for lex: nothing but blanks left to parse
+extern void runSubshell(const std::string &command);  // for lex: <(cmd), >(cmd)
+extern void parseString(const std::string &text);     // for lex: nested parse
+extern void parseFile(FILE *file);
 
 pid_t Command::_lastBackgroundPid = 0;
+int Command::_lastBackgroundStatus = -1;
 int Command::_lastReturnCode = 0;
 std::string Command::_lastArgument = "";
+int Command::_sourceDepth = 0;
+std::atomic<int> Command::_liveRelays(0);
+
+// Relay threads (cat feeders, tee relays, pipestat links) copy data for the
+// shell. They start with SIGPIPE blocked: a reader that quits early must give
+// them EPIPE, not kill the shell.
+template <typename Function, typename... Args>
+static std::thread startRelayThread(Function function, Args... args) {
+    sigset_t pipeSig, saved;
+    sigemptyset(&pipeSig);
+    sigaddset(&pipeSig, SIGPIPE);
+    pthread_sigmask(SIG_BLOCK, &pipeSig, &saved);
+    std::thread relay(function, args...);
+    pthread_sigmask(SIG_SETMASK, &saved, NULL);
+    return relay;
+}
 
 Command::Command() {
     // Initialize a new vector of Simple Commands
@@ -37,6 +76,10 @@ Command::Command() {
     _appendOut = false;  
     _appendErr = false;  
     _redirectError = false;
+    _timed = false;
+    _hereDoc = NULL;
+    _hereDocExpand = false;
+    _group = NULL;
 }
 
 void Command::insertSimpleCommand( SimpleCommand * simpleCommand ) {
@@ -53,6 +96,9 @@ void Command::clear() {
     // remove all references to the simple commands we've deallocated
     _simpleCommands.clear();
 
+    // directory listings are only shared within one command line
+    Glob::clearCache();
+
     // Check if _outFile and _errFile refer to the same object,
     // prevent repeated free causing seg fault
     // ls aaaa | grep jjjj ssss >& out < in
@@ -78,6 +124,90 @@ void Command::clear() {
     _appendOut = false;
     _appendErr = false;
     _redirectError = false; 
+    _timed = false;
+
+    delete _hereDoc;
+    _hereDoc = NULL;
+    _hereDocExpand = false;
+
+    for (auto &target : _teeOutFiles) {
+        delete target.file;
+    }
+    _teeOutFiles.clear();
+
+    for (auto &redirect : _fdRedirects) {
+        delete redirect.file;
+    }
+    _fdRedirects.clear();
+
+    delete _group;
+    _group = NULL;
+}
+
+// N>&M takes a single digit M, N>&- closes N: descriptors 10 and up are the shell's
+bool Command::isFdWord(const std::string &word) {
+    return word == "-" || (word.length() == 1 && isdigit(word[0]));
+}
+
+// source is the M of N>&M ("-" to close); the string is consumed
+void Command::insertFdRedirect(int fd, std::string *file, int flags, std::string *source) {
+    FdRedirect redirect;
+    redirect.fd = fd;
+    redirect.file = file;
+    redirect.flags = flags;
+    redirect.source = -1;
+    if (source != NULL) {
+        redirect.source = (*source == "-") ? -1 : atoi(source->c_str());
+        delete source;
+    }
+    _fdRedirects.push_back(redirect);
+}
+
+// Apply the numbered redirections, in order, to the shell's own descriptors.
+// saved gets (fd, copy of what was there or -1) for restoreFds.
+bool Command::applyFdRedirects(std::vector<std::pair<int, int>> &saved) {
+    for (auto &redirect : _fdRedirects) {
+        int fd = -1;
+        if (redirect.file != NULL) {
+            fd = open(redirect.file->c_str(), redirect.flags | O_CLOEXEC, 0664);
+            if (fd < 0) {
+                perror(redirect.file->c_str());
+                return false;
+            }
+        } else if (redirect.source >= 0 && fcntl(redirect.source, F_GETFD) < 0) {
+            fprintf(stderr, "%d: bad file descriptor\n", redirect.source);
+            return false;
+        }
+
+        saved.push_back({redirect.fd, fcntl(redirect.fd, F_DUPFD_CLOEXEC, Shell::_firstPrivateFd)});
+        if (redirect.file != NULL) {
+            dup2(fd, redirect.fd);
+            close(fd);
+        } else if (redirect.source >= 0) {
+            dup2(redirect.source, redirect.fd);
+        } else {
+            close(redirect.fd);
+        }
+    }
+    return true;
+}
+
+// Undo applyFdRedirects (latest first); keep leaves the new descriptors in
+// place, as "exec 3>file" does
+static void restoreFds(std::vector<std::pair<int, int>> &saved, bool keep) {
+    for (auto it = saved.rbegin(); it != saved.rend(); ++it) {
+        if (!keep) {
+            if (it->second >= 0) {
+                dup2(it->second, it->first);
+            } else {
+                close(it->first);
+            }
+        }
+        if (it->second >= 0) {
+            close(it->second);
+        }
+    }
+    saved.clear();
 }
 
 void Command::print() {
@@ -105,176 +235,1766 @@ void Command::print() {
                 _background?"YES":"NO",
                 _appendOut?"YES":"NO",      
                 _appendErr?"YES":"NO");     
+        for (auto &target : _teeOutFiles) {
+            printf( "  %-12s (also, %s)\n", target.file->c_str(),
+                    target.append ? "append" : "truncate" );
+        }
         printf( "\n\n" );
     }
 }
 
 // environmant expansion 3.1
 std::string Command::expandEnvironmentVariables(const std::string &arg) {
-    std::stringstream result;
-    
-    for (size_t i = 0; i < arg.length(); i++) {
-        // search for pattern: ${var} 
-        if (i + 1 < arg.length() && arg[i] == '$' && arg[i+1] == '{') {
-            // search for the ending of "var"
-            size_t end = arg.find('}', i + 2);
-            if (end != std::string::npos) {
-                // extract "var" -> varName
-                std::string varName = arg.substr(i + 2, end - (i + 2));
-                std::string replacement;
-                
-                if (varName == "$") {
-                    // PID of the shell process
-                    replacement = std::to_string(getpid());
-                } else if (varName == "?") {
-                    // return code of the last executed simple command
-                    replacement = std::to_string(_lastReturnCode);
-                } else if (varName == "!") {
-                    // PID of the last process run in the background
-                    replacement = std::to_string(_lastBackgroundPid);
-                } else if (varName == "_") {
-                    // last argument in the fully expanded previous command
-                    replacement = _lastArgument;
-                } else if (varName == "SHELL") {
-                    // path of your shell executable
-                    char path[PATH_MAX];
-                    if (realpath(Shell::_shellPath.c_str(), path) != NULL) {
-                        replacement = path;
-                    } else {
-                        replacement = Shell::_shellPath;
-                    }
+    SimpleCommand::Word word = SimpleCommand::compileWord(arg);
+    if (word.literal()) {
+        return arg;
+    }
+    std::string result;
+    expandWord(word, result);
+    return result;
+}
+
+// names variableValue answers itself instead of looking them up in the table
+static bool specialVariable(const char *name, size_t length) {
+    return (length == 1 && strchr("$?!_", name[0]) != NULL) ||
+           (length == 5 && memcmp(name, "SHELL", 5) == 0);
+}
+
+// value of ${name}, NULL when unset; numbers are formatted into digits[]
+const char *Command::variableValue(const char *name, size_t length, char (&digits)[24]) {
+    if (length == 1) {
+        switch (name[0]) {
+        case '$':
+            // PID of the shell process
+            snprintf(digits, sizeof(digits), "%d", (int) getpid());
+            return digits;
+        case '?':
+            // return code of the last executed simple command
+            snprintf(digits, sizeof(digits), "%d", _lastReturnCode);
+            return digits;
+        case '!':
+            // PID of the last process run in the background
+            snprintf(digits, sizeof(digits), "%d", (int) _lastBackgroundPid);
+            return digits;
+        case '_':
+            // last argument in the fully expanded previous command
+            return _lastArgument.c_str();
+        }
+    }
+    if (length == 5 && memcmp(name, "SHELL", 5) == 0) {
+        // path of your shell executable
+        static char path[PATH_MAX];
+        if (realpath(Shell::_shellPath.c_str(), path) != NULL) {
+            return path;
+        }
+        return Shell::_shellPath.c_str();
+    }
+    // 普通环境变量
+    const std::string *value = Variables::lookup(name, length);
+    return value ? value->c_str() : NULL;
+}
+
+// A reference's result: usually a pointer to the variable's own value,
+// otherwise built in digits or owned
+struct ExpandedValue {
+    const char *data;
+    size_t size;
+    char digits[24];
+    std::string owned;
+
+    void own() {
+        if (data != owned.data()) {
+            owned.assign(data, size);
+            data = owned.data();
+        }
+    }
+};
+
+static std::string expandOperand(const SimpleCommand::Word &operand) {
+    if (operand.literal()) {
+        return operand.text;
+    }
+    std::string result;
+    Command::expandWord(operand, result);
+    return result;
+}
+
+// ${name:offset:length} bounds; a negative offset or length counts from the end
+static long substringBound(const SimpleCommand::Word &operand, long size, long base) {
+    std::string text = expandOperand(operand);
+    const char *p = text.c_str();
+    while (*p == ' ' || *p == '(') {
+        p++;
+    }
+    long n = strtol(p, NULL, 10);
+    n = n < 0 ? size + n : base + n;
+    return n < 0 ? 0 : n > size ? size : n;
+}
+
+// $((expression)): the decimal result, or nothing after reporting an error
+static void expandArithmetic(const SimpleCommand::Word &word, const SimpleCommand::Word::Span &span,
+                             ExpandedValue &value) {
+    Arithmetic compiled;
+    const Arithmetic *expression = &compiled;
+    if (span.compiled >= 0) {
+        expression = &word.expressions[span.compiled];
+    } else {
+        compiled = Arithmetic::compile(expandOperand(word.operands[span.operand]));
+    }
+
+    long long result;
+    std::string error;
+    value.data = value.digits;
+    if (expression->evaluate(result, error)) {
+        value.size = snprintf(value.digits, sizeof(value.digits), "%lld", result);
+    } else {
+        value.size = 0;
+        value.digits[0] = '\0';
+        error = "arithmetic: " + error + "\n";
+        write(2, error.c_str(), error.length());
+        Command::_lastReturnCode = 1;
+    }
+}
+
+static void expandReference(const SimpleCommand::Word &word, const SimpleCommand::Word::Span &span,
+                            ExpandedValue &value) {
+    typedef SimpleCommand::Word Word;
+    if (span.op == Word::ARITHMETIC) {
+        expandArithmetic(word, span, value);
+        return;
+    }
+    const char *name = word.text.data() + span.offset;
+    const char *raw = Command::variableValue(name, span.length, value.digits);
+    bool set = raw != NULL && (!span.flag || raw[0] != '\0');
+    value.data = raw ? raw : "";
+    value.size = strlen(value.data);
+    if (word.assigns) {
+        // expanding an operand may assign, which can move the table
+        value.own();
+    }
+
+    switch (span.op) {
+    case Word::LITERAL:
+    case Word::VARIABLE:
+    case Word::ARITHMETIC:
+        break;
+    case Word::LENGTH:
+        value.size = snprintf(value.digits, sizeof(value.digits), "%zu", value.size);
+        value.data = value.digits;
+        break;
+    case Word::DEFAULT:
+    case Word::ASSIGN:
+        if (!set) {
+            value.owned = expandOperand(word.operands[span.operand]);
+            value.data = value.owned.data();
+            value.size = value.owned.size();
+            if (span.op == Word::ASSIGN) {
+                Variables::set(std::string(name, span.length), value.owned);
+            }
+        }
+        break;
+    case Word::ALTERNATE:
+        value.owned = set ? expandOperand(word.operands[span.operand]) : "";
+        value.data = value.owned.data();
+        value.size = value.owned.size();
+        break;
+    case Word::PREFIX:
+    case Word::SUFFIX:
+    case Word::REPLACE: {
+        Pattern compiled;
+        const Pattern *pattern = &compiled;
+        if (span.compiled >= 0) {
+            pattern = &word.patterns[span.compiled];
+        } else {
+            compiled = Pattern::compile(expandOperand(word.operands[span.operand]));
+        }
+        if (span.op == Word::PREFIX) {
+            long n = pattern->matchPrefix(value.data, value.size, span.flag);
+            if (n > 0) {
+                value.data += n;
+                value.size -= n;
+            }
+        } else if (span.op == Word::SUFFIX) {
+            long n = pattern->matchSuffix(value.data, value.size, span.flag);
+            if (n > 0) {
+                value.size -= n;
+            }
+        } else {
+            // longest match at the leftmost position, once or (//) everywhere
+            std::string replacement;
+            if (span.operand2 >= 0) {
+                replacement = expandOperand(word.operands[span.operand2]);
+            }
+            std::string result;
+            size_t i = 0;
+            bool replaced = false;
+            while (i < value.size) {
+                long n = -1;
+                if (!replaced || span.flag) {
+                    n = pattern->matchPrefix(value.data + i, value.size - i, true);
+                }
+                if (n > 0) {
+                    result += replacement;
+                    i += n;
+                    replaced = true;
                 } else {
-                    // 普通环境变量
-                    const char *value = getenv(varName.c_str());
-                    replacement = value ? value : "";
-                }
-                
-                // 添加替换后的值
-                result << replacement;
-                
-                // 跳过整个变量引用
-                i = end;
-            } else {
-                // 未找到匹配的 }, 保留原字符
-                result << arg[i];
+                    result += value.data[i++];
+                }
             }
+            value.owned.swap(result);
+            value.data = value.owned.data();
+            value.size = value.owned.size();
+        }
+        break;
+    }
+    case Word::SUBSTRING: {
+        long size = (long) value.size;
+        long from = substringBound(word.operands[span.operand], size, 0);
+        long to = size;
+        if (span.operand2 >= 0) {
+            to = substringBound(word.operands[span.operand2], size, from);
+        }
+        value.data += from;
+        value.size = to > from ? to - from : 0;
+        break;
+    }
+    }
+}
+
+// Evaluate a compiled word into out, from span "first" on: the values are
+// looked up first so the result is allocated once at its final size
+void Command::expandWord(const SimpleCommand::Word &word, std::string &out, size_t first) {
+    ExpandedValue stackValues[8];
+    std::vector<ExpandedValue> heapValues;
+    ExpandedValue *values = stackValues;
+    if (word.variables > 8) {
+        heapValues.resize(word.variables);
+        values = heapValues.data();
+    }
+
+    size_t length = 0;
+    size_t v = 0;
+    for (size_t s = first; s < word.spans.size(); s++) {
+        auto &span = word.spans[s];
+        if (span.op == SimpleCommand::Word::LITERAL) {
+            length += span.length;
+            continue;
+        }
+        ExpandedValue &value = values[v++];
+        expandReference(word, span, value);
+        if (word.assigns) {
+            // a later ${name:=word} must not move what this one points to
+            value.own();
+        }
+        length += value.size;
+    }
+
+    out.clear();
+    out.reserve(length);
+    v = 0;
+    for (size_t s = first; s < word.spans.size(); s++) {
+        auto &span = word.spans[s];
+        if (span.op == SimpleCommand::Word::LITERAL) {
+            out.append(word.text, span.offset, span.length);
         } else {
-            // 保留其他字符
-            result << arg[i];
+            out.append(values[v].data, values[v].size);
+            v++;
+        }
+    }
+}
+
+// "setenv X ${X}suffix": the value starts with the variable being set, so
+// the suffix can be appended in place (not for PATH, whose setEnv also
+// drops the path cache, nor for names like SHELL whose ${X} is not the
+// stored value)
+bool Command::isSelfAppend(SimpleCommand *cmd) {
+    if (cmd->_arguments.size() != 3 || *(cmd->_arguments[0]) != "setenv" ||
+        !cmd->_words[1].literal() || cmd->_words[2].literal()) {
+        return false;
+    }
+    const SimpleCommand::Word &word = cmd->_words[2];
+    const std::string &name = *(cmd->_arguments[1]);
+    return word.spans[0].op == SimpleCommand::Word::VARIABLE && name != "PATH" &&
+           !specialVariable(name.data(), name.length()) &&
+           word.text.compare(word.spans[0].offset, word.spans[0].length, name) == 0;
+}
+
+static int availableCpus();
+
+// Unquoted words with *, ? or [...] become the sorted file names they match;
+// a word that matches nothing is passed on as it is.
+//   setenv MYSHELL_GLOB_THREADS n: workers for a ** walk (default: one per CPU)
+void Command::expandPathnames(SimpleCommand *cmd, bool selfAppend) {
+    std::vector<std::string> matches;
+    for (size_t j = 0; j < cmd->_arguments.size(); j++) {
+        if (cmd->_words[j].quoted || (selfAppend && j == 2) ||
+            !Glob::hasWildcard(*(cmd->_arguments[j]))) {
+            continue;
+        }
+        if (cmd->_arguments[j]->find("**") != std::string::npos) {
+            const char *threads = Variables::get("MYSHELL_GLOB_THREADS");
+            Glob::_threads = threads != NULL && atoi(threads) > 0 ? atoi(threads) : availableCpus();
+        }
+        matches.clear();
+        if (Glob::expand(*(cmd->_arguments[j]), matches)) {
+            cmd->replaceArgument(j, matches);
+            j += matches.size() - 1;
+        }
+    }
+}
+
+// check if it's a builtin command
+bool Command::isBuiltInCommand(SimpleCommand *cmd) {
+    if (cmd->_arguments.size() == 0) {
+        return false;
+    }
+    
+    const char *command = cmd->_arguments[0]->c_str();
+    
+    return (strcmp(command, "printenv") == 0 || 
+            strcmp(command, "setenv") == 0 || 
+            strcmp(command, "unsetenv") == 0 || 
+            strcmp(command, "cd") == 0 || 
+            strcmp(command, "source") == 0 ||
+            strcmp(command, "hash") == 0 ||
+            strcmp(command, "exec") == 0 ||
+            strcmp(command, "jobs") == 0 ||
+            strcmp(command, "fg") == 0 ||
+            strcmp(command, "bg") == 0 ||
+            strcmp(command, "wait") == 0 ||
+            strcmp(command, "((") == 0 ||
+            strcmp(command, "parallel") == 0);
+}
+
+// check if it's the printenv command
+bool Command::isPrintEnvCommand(SimpleCommand *cmd) {
+    if (cmd->_arguments.size() == 0) {
+        return false;
+    }
+    return (strcmp(cmd->_arguments[0]->c_str(), "printenv") == 0);
+}
+
+// builtins that must run in the shell process itself, even inside a pipeline:
+// they change its state or act on its children
+bool Command::isStateBuiltin(SimpleCommand *cmd) {
+    const char *command = cmd->_arguments[0]->c_str();
+    return (strcmp(command, "setenv") == 0 ||
+            strcmp(command, "unsetenv") == 0 ||
+            strcmp(command, "cd") == 0 ||
+            strcmp(command, "source") == 0 ||
+            strcmp(command, "exec") == 0 ||
+            strcmp(command, "fg") == 0 ||
+            strcmp(command, "bg") == 0 ||
+            strcmp(command, "wait") == 0);
+}
+
+// execute printenv, printing all environment variables
+void Command::printEnv() {
+    Variables::print();
+}
+
+// setenv
+void Command::setEnv(const char *var, const char *value) {
+    if (var[0] == '\0' || strchr(var, '=') != NULL) {
+        const char *errMsg = "setenv: Error setting environment variable\n";
+        write(2, errMsg, strlen(errMsg));
+        return;
+    }
+    Variables::set(var, value);
+    if (strcmp(var, "PATH") == 0) {
+        PathCache::invalidate();
+    }
+}
+
+// unsetenv
+void Command::unsetEnv(const char *var) {
+    if (var[0] == '\0' || strchr(var, '=') != NULL) {
+        const char *errMsg = "unsetenv: Error unsetting environment variable\n";
+        write(2, errMsg, strlen(errMsg));
+        return;
+    }
+    Variables::unset(var);
+    if (strcmp(var, "PATH") == 0) {
+        PathCache::invalidate();
+    }
+}
+
+// cd
+void Command::changeDirectory(const char *dir) {
+    const char *target;
+    
+    if (dir == NULL || strlen(dir) == 0) {
+        // If no directory is specified, default to the home
+        target = Variables::get("HOME");
+        if (target == NULL) {
+            const char *errMsg = "cd: HOME not set\n";
+            write(2, errMsg, strlen(errMsg));
+            return;
+        }
+    } else {
+        target = dir;
+    }
+    
+    if (chdir(target) != 0) {
+        std::string errMsg = "cd: can't cd to " + std::string(target) + "\n";
+        write(2, errMsg.c_str(), errMsg.length());
+    }
+}
+
+// Replace the shell process itself (exec builtin, tail call).
+// Returns only if the exec failed; the shell keeps running in that case.
+void Command::execInPlace(std::vector<char *> &args, const std::string &path,
+                          const std::vector<int> &privateFds) {
+    // the shell's own descriptors vanish on success but stay usable on failure
+    for (int fd : privateFds) {
+        fcntl(fd, F_SETFD, FD_CLOEXEC);
+    }
+    fflush(stdout);
+    fflush(stderr);
+
+    sigset_t blocked;
+    sigprocmask(SIG_SETMASK, &Shell::_childSigmask, &blocked);
+    execve(path.c_str(), args.data(), Variables::envp());
+    sigprocmask(SIG_SETMASK, &blocked, NULL);
+
+    perror("execvp");
+    for (int fd : privateFds) {
+        fcntl(fd, F_SETFD, 0);
+    }
+}
+
+// text of the pipeline, as shown by "jobs"
+std::string Command::commandLine() {
+    std::string line;
+    for (size_t i = 0; i < _simpleCommands.size(); i++) {
+        if (i > 0) {
+            line += " | ";
+        }
+        for (size_t j = 0; j < _simpleCommands[i]->_arguments.size(); j++) {
+            if (j > 0) {
+                line += " ";
+            }
+            line += *(_simpleCommands[i]->_arguments[j]);
+        }
+    }
+    if (_background) {
+        line += " &";
+    }
+    return line;
+}
+
+static int exitCode(int status) {
+    if (WIFEXITED(status)) {
+        return WEXITSTATUS(status);
+    }
+    return 128 + WTERMSIG(status);
+}
+
+// Job selected by the builtin's first argument, the current job by default
+static Job *jobArgument(SimpleCommand *cmd, const char *builtin) {
+    Job *job = (cmd->_arguments.size() > 1) ? JobTable::parseSpec(cmd->_arguments[1]->c_str())
+                                            : JobTable::current();
+    if (job == NULL) {
+        std::string errMsg = std::string(builtin) + ": no such job\n";
+        write(2, errMsg.c_str(), errMsg.length());
+    }
+    return job;
+}
+
+// hand the terminal to a process group; SIGTTOU is blocked meanwhile because
+// the shell may itself be in the background group at that point
+static void giveTerminal(pid_t pgid) {
+    sigset_t ttou, old;
+    sigemptyset(&ttou);
+    sigaddset(&ttou, SIGTTOU);
+    sigprocmask(SIG_BLOCK, &ttou, &old);
+    tcsetpgrp(0, pgid);
+    sigprocmask(SIG_SETMASK, &old, NULL);
+}
+
+// fg [%job]: continue the job in the foreground and wait for it
+void Command::foregroundJob(SimpleCommand *cmd) {
+    Job *job = jobArgument(cmd, "fg");
+    if (job == NULL) {
+        _lastReturnCode = 1;
+        return;
+    }
+
+    printf("%s\n", job->_commandLine.c_str());
+    fflush(stdout);
+
+    bool terminal = isatty(0);
+    if (terminal) {
+        giveTerminal(job->_pgid);
+    }
+    if (job->_stopped) {
+        kill(-job->_pgid, SIGCONT);
+        job->_stopped = false;
+    }
+
+    // background children are only reaped from the input loop: nobody else takes these
+    for (pid_t pid : job->_pids) {
+        int status;
+        struct rusage usage;
+        if (wait4(pid, &status, WUNTRACED, &usage) != pid) {
+            continue;  // already reaped
+        }
+        JobTable::childStatus(pid, status, usage);
+        if (WIFSTOPPED(status)) {
+            break;
+        }
+    }
+
+    if (terminal) {
+        giveTerminal(getpgrp());
+    }
+
+    if (job->_stopped) {
+        printf("\n[%d]+ Stopped %s\n", job->_id, job->_commandLine.c_str());
+        _lastReturnCode = 128 + SIGTSTP;
+    } else {
+        _lastReturnCode = exitCode(job->_status);
+        JobTable::remove(job);
+    }
+}
+
+// bg [%job]: let a stopped job continue in the background
+void Command::backgroundJob(SimpleCommand *cmd) {
+    Job *job = jobArgument(cmd, "bg");
+    if (job == NULL) {
+        _lastReturnCode = 1;
+        return;
+    }
+
+    if (job->_stopped) {
+        kill(-job->_pgid, SIGCONT);
+        job->_stopped = false;
+    }
+    printf("[%d]+ %s\n", job->_id, job->_commandLine.c_str());
+    _lastReturnCode = 0;
+}
+
+// wait [-n] [%job|pid]: no argument waits for every background job,
+// -n for whichever finishes next
+void Command::waitCommand(SimpleCommand *cmd) {
+    bool any = cmd->_arguments.size() > 1 && strcmp(cmd->_arguments[1]->c_str(), "-n") == 0;
+    size_t first = any ? 2 : 1;
+
+    if (first < cmd->_arguments.size()) {
+        _lastReturnCode = 0;
+        for (size_t i = first; i < cmd->_arguments.size(); i++) {
+            Job *job = JobTable::parseSpec(cmd->_arguments[i]->c_str());
+            if (job == NULL && _lastBackgroundStatus >= 0 &&
+                atoi(cmd->_arguments[i]->c_str()) == _lastBackgroundPid) {
+                // a script's $! whose job was already dropped
+                _lastReturnCode = exitCode(_lastBackgroundStatus);
+                continue;
+            }
+            if (job == NULL) {
+                std::string errMsg = "wait: " + *(cmd->_arguments[i]) + ": no such job\n";
+                write(2, errMsg.c_str(), errMsg.length());
+                _lastReturnCode = 127;
+                continue;
+            }
+            while (!job->done()) {
+                Shell::waitForChildren();
+            }
+            _lastReturnCode = exitCode(job->_status);
+            JobTable::remove(job);
+        }
+        return;
+    }
+
+    if (any) {
+        for (;;) {
+            Job *finished = NULL;
+            for (auto &item : JobTable::_byId) {
+                if (item.second->done() && (finished == NULL || item.first < finished->_id)) {
+                    finished = item.second;
+                }
+            }
+            if (finished != NULL) {
+                _lastReturnCode = exitCode(finished->_status);
+                JobTable::remove(finished);
+                return;
+            }
+            if (!JobTable::anyRunning()) {
+                _lastReturnCode = 127;
+                return;
+            }
+            Shell::waitForChildren();
+        }
+    }
+
+    while (JobTable::anyRunning()) {
+        Shell::waitForChildren();
+    }
+    std::vector<Job *> finished;
+    for (auto &item : JobTable::_byId) {
+        if (item.second->done()) {
+            finished.push_back(item.second);
+        }
+    }
+    for (Job *job : finished) {
+        JobTable::remove(job);
+    }
+    _lastReturnCode = 0;
+}
+
+// CPUs this shell may actually use: the affinity mask, capped by a cgroup v2 quota
+static int availableCpus() {
+    int cpus;
+    cpu_set_t set;
+    if (sched_getaffinity(0, sizeof(set), &set) == 0) {
+        cpus = CPU_COUNT(&set);
+    } else {
+        cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    }
+
+    FILE *f = fopen("/sys/fs/cgroup/cpu.max", "re");
+    if (f != NULL) {
+        long quota, period;
+        if (fscanf(f, "%ld %ld", &quota, &period) == 2 && quota > 0 && period > 0) {
+            cpus = std::min(cpus, (int)std::ceil((double)quota / period));
         }
+        fclose(f);
+    }
+    return std::max(cpus, 1);
+}
+
+// per-stage accounting for the time keyword
+struct StageTime {
+    std::string name;
+    pid_t pid;              // 0 for a builtin run by the shell itself
+    double start;
+    double end;
+    struct rusage usage;
+};
+
+static double now() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// time: one line per stage plus the pipeline total on stderr,
+// or a single JSON object when ${MYSHELL_TIMEFORMAT} is "json"
+static void reportTimes(const std::vector<StageTime> &stages, double start, double end) {
+    struct rusage total;
+    memset(&total, 0, sizeof(total));
+    for (auto &stage : stages) {
+        timeradd(&total.ru_utime, &stage.usage.ru_utime, &total.ru_utime);
+        timeradd(&total.ru_stime, &stage.usage.ru_stime, &total.ru_stime);
+        total.ru_maxrss = std::max(total.ru_maxrss, stage.usage.ru_maxrss);
+        total.ru_nvcsw += stage.usage.ru_nvcsw;
+        total.ru_nivcsw += stage.usage.ru_nivcsw;
+    }
+
+    const char *format = Variables::get("MYSHELL_TIMEFORMAT");
+    bool json = format != NULL && strcmp(format, "json") == 0;
+    std::string report;
+    char line[512];
+
+    auto seconds = [](const struct timeval &tv) { return tv.tv_sec + tv.tv_usec / 1e6; };
+
+    if (json) {
+        snprintf(line, sizeof(line),
+                 "{\"real\":%.6f,\"user\":%.6f,\"sys\":%.6f,\"maxrss_kb\":%ld,"
+                 "\"vcsw\":%ld,\"ivcsw\":%ld,\"stages\":[",
+                 end - start, seconds(total.ru_utime), seconds(total.ru_stime),
+                 total.ru_maxrss, total.ru_nvcsw, total.ru_nivcsw);
+        report += line;
+        for (size_t i = 0; i < stages.size(); i++) {
+            const StageTime &stage = stages[i];
+            std::string name;
+            for (char c : stage.name) {
+                if (c == '"' || c == '\\') {
+                    name += '\\';
+                }
+                name += c;
+            }
+            snprintf(line, sizeof(line),
+                     "%s{\"cmd\":\"%s\",\"pid\":%d,\"real\":%.6f,\"user\":%.6f,\"sys\":%.6f,"
+                     "\"maxrss_kb\":%ld,\"vcsw\":%ld,\"ivcsw\":%ld}",
+                     i > 0 ? "," : "", name.c_str(), stage.pid,
+                     std::max(stage.end - stage.start, 0.0),
+                     seconds(stage.usage.ru_utime), seconds(stage.usage.ru_stime),
+                     stage.usage.ru_maxrss, stage.usage.ru_nvcsw, stage.usage.ru_nivcsw);
+            report += line;
+        }
+        report += "]}\n";
+    } else {
+        report += "          real      user       sys    maxrss   vcsw  ivcsw\n";
+        for (size_t i = 0; i < stages.size(); i++) {
+            const StageTime &stage = stages[i];
+            snprintf(line, sizeof(line), "[%zu]   %8.3fs %8.3fs %8.3fs %7ldKB %6ld %6ld  %s\n",
+                     i, std::max(stage.end - stage.start, 0.0),
+                     seconds(stage.usage.ru_utime), seconds(stage.usage.ru_stime),
+                     stage.usage.ru_maxrss, stage.usage.ru_nvcsw, stage.usage.ru_nivcsw,
+                     stage.name.c_str());
+            report += line;
+        }
+        snprintf(line, sizeof(line), "total %8.3fs %8.3fs %8.3fs %7ldKB %6ld %6ld\n",
+                 end - start, seconds(total.ru_utime), seconds(total.ru_stime),
+                 total.ru_maxrss, total.ru_nvcsw, total.ru_nivcsw);
+        report += line;
+    }
+    write(2, report.c_str(), report.length());
+}
+
+// pipestat: one relay per pipe link, between the two pipes that replace it
+struct LinkStat {
+    size_t bytes;
+    double emptyWait;   // relay waited for upstream data: the reader was starved
+    double fullWait;    // relay waited for downstream room: the writer was blocked
+    double start;
+    double end;
+};
+
+// Move everything from in to out with pipe-to-pipe splice (no copy), timing
+// which side held things up whenever the relay had to wait
+static void relayLink(std::shared_ptr<LinkStat> link, int in, int out) {
+    link->start = now();
+    for (;;) {
+        ssize_t n = splice(in, NULL, out, NULL, 1 << 20, SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+        if (n > 0) {
+            link->bytes += n;
+            continue;
+        }
+        if (n == 0 || (errno != EAGAIN && errno != EINTR)) {
+            // upstream finished, or downstream went away (EPIPE)
+            break;
+        }
+
+        struct pollfd pfd = { in, POLLIN, 0 };
+        bool upstreamEmpty = poll(&pfd, 1, 0) == 0;
+        if (!upstreamEmpty) {
+            pfd.fd = out;
+            pfd.events = POLLOUT;
+        }
+        double waitStart = now();
+        while (poll(&pfd, 1, -1) < 0 && errno == EINTR) {
+        }
+        if (upstreamEmpty) {
+            link->emptyWait += now() - waitStart;
+        } else {
+            link->fullWait += now() - waitStart;
+        }
+    }
+    link->end = now();
+    close(in);
+    close(out);
+}
+
+// pipestat table on stderr. A stage is the bottleneck when the writer before
+// it is blocked on a full pipe and the reader after it starves on an empty one.
+static void reportPipestat(const std::vector<std::shared_ptr<LinkStat>> &links,
+                           const std::vector<std::string> &names) {
+    std::string report = "link                        bytes        MB/s   starved   blocked\n";
+    char line[512];
+    for (size_t i = 0; i < links.size(); i++) {
+        const LinkStat &link = *links[i];
+        double elapsed = std::max(link.end - link.start, 1e-9);
+        std::string pair = names[i] + " -> " + names[i + 1];
+        snprintf(line, sizeof(line), "[%zu] %-22.22s %12zu %11.1f %8.3fs %8.3fs\n",
+                 i, pair.c_str(), link.bytes, link.bytes / elapsed / 1e6,
+                 link.emptyWait, link.fullWait);
+        report += line;
+    }
+
+    size_t bottleneck = 0;
+    double worst = -1;
+    for (size_t k = 0; k < names.size(); k++) {
+        double score = 0;
+        int sides = 0;
+        if (k > 0) {
+            score += links[k - 1]->fullWait;
+            sides++;
+        }
+        if (k < links.size()) {
+            score += links[k]->emptyWait;
+            sides++;
+        }
+        score /= sides;
+        if (score > worst) {
+            worst = score;
+            bottleneck = k;
+        }
+    }
+    snprintf(line, sizeof(line), "bottleneck: [%zu] %s (%.3fs holding up its neighbours)\n",
+             bottleneck, names[bottleneck].c_str(), worst);
+    report += line;
+    write(2, report.c_str(), report.length());
+}
+
+// parallel [-j N] cmd args... [::: items...]
+// Runs cmd once per item ({} in an argument is replaced by the item, otherwise
+// the item is appended), with at most N children at a time. Items come from
+// the arguments after ":::" or from stdin, one per line. Output of each child
+// is buffered and written in input order.
+void Command::parallelCommand(SimpleCommand *cmd, const std::vector<int> &privateFds) {
+    std::vector<std::string> arguments;
+    for (auto &arg : cmd->_arguments) {
+        arguments.push_back(*arg);
+    }
+
+    int jobs = availableCpus();
+    size_t first = 1;
+    if (first + 1 < arguments.size() && arguments[first] == "-j") {
+        jobs = std::max(atoi(arguments[first + 1].c_str()), 1);
+        first += 2;
+    } else if (first < arguments.size() && arguments[first].compare(0, 2, "-j") == 0) {
+        jobs = std::max(atoi(arguments[first].c_str() + 2), 1);
+        first++;
+    }
+
+    std::vector<std::string> templateArgs;
+    std::vector<std::string> items;
+    bool itemsFromArgs = false;
+    for (size_t i = first; i < arguments.size(); i++) {
+        if (!itemsFromArgs && arguments[i] == ":::") {
+            itemsFromArgs = true;
+        } else if (itemsFromArgs) {
+            items.push_back(arguments[i]);
+        } else {
+            templateArgs.push_back(arguments[i]);
+        }
+    }
+
+    if (templateArgs.empty()) {
+        const char *errMsg = "parallel: usage: parallel [-j N] command [args] [::: items]\n";
+        write(2, errMsg, strlen(errMsg));
+        _lastReturnCode = 1;
+        return;
+    }
+
+    if (!itemsFromArgs) {
+        std::string input;
+        char buffer[4096];
+        ssize_t n;
+        while ((n = read(0, buffer, sizeof(buffer))) > 0) {
+            input.append(buffer, n);
+        }
+        size_t start = 0;
+        while (start < input.length()) {
+            size_t end = input.find('\n', start);
+            if (end == std::string::npos) {
+                end = input.length();
+            }
+            items.push_back(input.substr(start, end - start));
+            start = end + 1;
+        }
+    }
+
+    std::string path;
+    if (!PathCache::lookup(templateArgs[0], path)) {
+        std::string errMsg = templateArgs[0] + ": command not found\n";
+        write(2, errMsg.c_str(), errMsg.length());
+        _lastReturnCode = 127;
+        return;
+    }
+
+    bool hasPlaceholder = false;
+    for (auto &arg : templateArgs) {
+        if (arg.find("{}") != std::string::npos) {
+            hasPlaceholder = true;
+        }
+    }
+
+    struct Slot {
+        size_t item;
+        pid_t pid;
+        int fd;
+    };
+    std::vector<Slot> running;
+    std::vector<std::string> outputs(items.size());
+    std::vector<int> exitCodes(items.size(), -1);
+    size_t nextItem = 0;
+    size_t nextOutput = 0;
+    int failed = 0;
+
+    // children read from /dev/null when the items came in on stdin
+    int nullFd = itemsFromArgs ? -1 : open("/dev/null", O_RDONLY | O_CLOEXEC);
+    int savedIn = fcntl(0, F_DUPFD_CLOEXEC, 10);
+    int savedOut = fcntl(1, F_DUPFD_CLOEXEC, 10);
+    if (savedIn < 0 || savedOut < 0) {
+        // without them the shell's own stdout would stay on a child's pipe
+        perror("parallel");
+        for (int fd : {savedIn, savedOut, nullFd}) {
+            if (fd >= 0) {
+                close(fd);
+            }
+        }
+        _lastReturnCode = 1;
+        return;
+    }
+    double startTime = now();
+
+    while (nextOutput < items.size()) {
+        // keep up to N children running
+        while (running.size() < (size_t)jobs && nextItem < items.size()) {
+            std::vector<std::string> expanded;
+            for (auto &arg : templateArgs) {
+                std::string value = arg;
+                size_t pos = 0;
+                while ((pos = value.find("{}", pos)) != std::string::npos) {
+                    value.replace(pos, 2, items[nextItem]);
+                    pos += items[nextItem].length();
+                }
+                expanded.push_back(value);
+            }
+            if (!hasPlaceholder) {
+                expanded.push_back(items[nextItem]);
+            }
+            std::vector<char *> args;
+            for (auto &arg : expanded) {
+                args.push_back((char *)arg.c_str());
+            }
+            args.push_back(NULL);
+
+            int fdpipe[2];
+            if (pipe2(fdpipe, O_CLOEXEC) == -1) {
+                perror("pipe");
+                // retry once a running child has given its descriptors back;
+                // with none running that would never happen, so give up on it
+                if (!running.empty()) {
+                    break;
+                }
+                exitCodes[nextItem] = 127;
+                nextItem++;
+                continue;
+            }
+            dup2(fdpipe[1], 1);
+            close(fdpipe[1]);
+            if (nullFd >= 0) {
+                dup2(nullFd, 0);
+            }
+
+            std::vector<int> closeFds = privateFds;
+            closeFds.push_back(savedIn);
+            closeFds.push_back(savedOut);
+            pid_t pid = launchProcess(args, path, closeFds, -1);
+
+            dup2(savedOut, 1);
+            dup2(savedIn, 0);
+
+            if (pid < 0) {
+                close(fdpipe[0]);
+                exitCodes[nextItem] = 127;
+                nextItem++;
+                continue;
+            }
+            running.push_back({nextItem, pid, fdpipe[0]});
+            nextItem++;
+        }
+
+        // flush finished items in input order
+        while (nextOutput < items.size() && exitCodes[nextOutput] >= 0) {
+            write(1, outputs[nextOutput].data(), outputs[nextOutput].length());
+            std::string().swap(outputs[nextOutput]);
+            if (exitCodes[nextOutput] != 0) {
+                failed++;
+                std::string errMsg = "parallel: " + items[nextOutput] + ": exit " +
+                                     std::to_string(exitCodes[nextOutput]) + "\n";
+                write(2, errMsg.c_str(), errMsg.length());
+            }
+            nextOutput++;
+        }
+        if (running.empty()) {
+            if (nextItem >= items.size()) {
+                break;
+            }
+            continue;
+        }
+
+        // drain whichever children have output, reap the ones that closed it
+        std::vector<struct pollfd> fds;
+        for (auto &slot : running) {
+            fds.push_back({slot.fd, POLLIN, 0});
+        }
+        if (poll(fds.data(), fds.size(), -1) < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            perror("poll");
+            break;
+        }
+        for (size_t k = running.size(); k-- > 0;) {
+            if (fds[k].revents == 0) {
+                continue;
+            }
+            char buffer[65536];
+            ssize_t n = read(running[k].fd, buffer, sizeof(buffer));
+            if (n > 0) {
+                outputs[running[k].item].append(buffer, n);
+                continue;
+            }
+            if (n < 0 && errno == EINTR) {
+                continue;
+            }
+
+            int status;
+            close(running[k].fd);
+            waitpid(running[k].pid, &status, 0);
+            exitCodes[running[k].item] = WIFEXITED(status) ? WEXITSTATUS(status)
+                                                           : 128 + WTERMSIG(status);
+            running.erase(running.begin() + k);
+        }
+    }
+
+    double elapsed = now() - startTime;
+    close(savedIn);
+    close(savedOut);
+    if (nullFd >= 0) {
+        close(nullFd);
+    }
+
+    char summary[160];
+    snprintf(summary, sizeof(summary), "parallel: %zu items, %d failed, %.3fs (%.1f items/s, -j %d)\n",
+             items.size(), failed, elapsed, elapsed > 0 ? items.size() / elapsed : 0.0, jobs);
+    write(2, summary, strlen(summary));
+
+    _lastReturnCode = failed > 0 ? 1 : 0;
+}
+
+// hash: show the lookup cache, "hash -r" empties it, "hash name..." looks names up
+void Command::hashCommand(SimpleCommand *cmd) {
+    if (cmd->_arguments.size() < 2) {
+        PathCache::print();
+        _lastReturnCode = 0;
+        return;
+    }
+
+    _lastReturnCode = 0;
+    for (size_t i = 1; i < cmd->_arguments.size(); i++) {
+        const char *arg = cmd->_arguments[i]->c_str();
+        if (strcmp(arg, "-r") == 0) {
+            PathCache::invalidate();
+            continue;
+        }
+        std::string path;
+        if (!PathCache::lookup(arg, path)) {
+            std::string errMsg = "hash: " + std::string(arg) + ": not found\n";
+            write(2, errMsg.c_str(), errMsg.length());
+            _lastReturnCode = 1;
+        }
+    }
+}
+
+// source: incorrect yet
+bool Command::sourceFile(const char *filename) {
+    FILE *file = fopen(filename, "re");
+    
+    if (!file) {
+        std::string errMsg = "source: can't open " + std::string(filename) + "\n";
+        write(2, errMsg.c_str(), errMsg.length());
+        return false;
+    }
+    
+    // 解析文件中的命令
+    bool old_tty = Shell::_isTerminal;
+    Shell::_isTerminal = false;  // 在解析脚本文件时禁用终端模式
+    
+    // 临时状态标记
+    bool originalCommandRunning = commandRunning;
+    commandRunning = false;
+    
+    // 执行命令
+    // the file gets its own scanner buffer; the outer input resumes afterwards
+    _sourceDepth++;
+    parseFile(file);
+    _sourceDepth--;
+    
+    // 恢复设置
+    Shell::_isTerminal = old_tty;
+    fclose(file);
+    
+    // 恢复原始状态标记
+    commandRunning = originalCommandRunning;
+    
+    return true;
+}
+
+// launch backend, read on every launch so it can be switched at runtime:
+//   setenv MYSHELL_LAUNCH fork | vfork | spawn (default)
+Command::LaunchMode Command::launchMode() {
+    const char *mode = Variables::get("MYSHELL_LAUNCH");
+    if (mode != NULL) {
+        if (strcmp(mode, "fork") == 0) {
+            return LAUNCH_FORK;
+        }
+        if (strcmp(mode, "vfork") == 0) {
+            return LAUNCH_VFORK;
+        }
+    }
+    return LAUNCH_SPAWN;
+}
+
+// ${MYSHELL_FDTRACE}: list the descriptors a child holds right after exec,
+// to check that nothing but its own stdin/stdout/stderr leaked into it.
+// A forked child reports itself before exec, with traceOwnFds.
+static void traceInheritedFds(pid_t pid, const char *name) {
+    if (Variables::get("MYSHELL_FDTRACE") == NULL) {
+        return;
+    }
+
+    std::string dirName = "/proc/" + std::to_string(pid) + "/fd";
+    std::string report = "fdtrace: [" + std::to_string(pid) + "] " + name + ":";
+    DIR *dir = opendir(dirName.c_str());
+    if (dir == NULL) {
+        report += " (already exited)";
+    } else {
+        std::vector<int> fds;
+        struct dirent *entry;
+        while ((entry = readdir(dir)) != NULL) {
+            int fd = atoi(entry->d_name);
+            if (entry->d_name[0] == '.') {
+                continue;
+            }
+            fds.push_back(fd);
+        }
+        closedir(dir);
+        std::sort(fds.begin(), fds.end());
+        for (int fd : fds) {
+            report += " " + std::to_string(fd);
+        }
+        if (fds.empty()) {
+            // a zombie has no descriptor table left
+            report += " (already exited)";
+        }
+    }
+    report += "\n";
+    write(2, report.c_str(), report.length());
+}
+
+// The same report from a forked child just before its exec, for the
+// descriptors below limit that are not close-on-exec. Other threads of the
+// shell may have held the allocator or a stdio lock at the fork, so only
+// fcntl and write are used here.
+static void traceOwnFds(const char *name, int limit) {
+    char report[512];
+    size_t length = 0;
+    auto put = [&](const char *text) {
+        while (*text != '\0' && length < sizeof(report) - 1) {
+            report[length++] = *text++;
+        }
+    };
+    auto putNumber = [&](long number) {
+        char digits[24];
+        int count = 0;
+        do {
+            digits[count++] = '0' + number % 10;
+            number /= 10;
+        } while (number > 0);
+        while (count > 0 && length < sizeof(report) - 1) {
+            report[length++] = digits[--count];
+        }
+    };
+
+    put("fdtrace: [");
+    putNumber(getpid());
+    put("] ");
+    put(name);
+    put(":");
+    for (int fd = 0; fd < limit; fd++) {
+        int flags = fcntl(fd, F_GETFD);
+        if (flags >= 0 && !(flags & FD_CLOEXEC)) {
+            put(" ");
+            putNumber(fd);
+        }
+    }
+    report[length++] = '\n';
+    write(2, report, length);
+}
+
+// execve copies argv and envp onto the new stack, and ARG_MAX bounds the
+// strings plus their pointers. Like xargs, keep 2048 bytes in hand. Linux
+// also refuses any single string longer than 32 pages.
+static const size_t argSlack = 2048;
+static const size_t maxArgLength = 32 * 4096;
+
+// Check argv against ARG_MAX before anything is forked. False when it cannot
+// be exec'd as it is. When it is too long but ${MYSHELL_ARGSPLIT} allows it,
+// cuts gets the index where each batch after the first starts: the words in
+// front of the expanded ones go with every batch, the expanded ones are
+// spread over the batches as xargs would, and jobs batches may run at once.
+//   setenv MYSHELL_ARGSPLIT on | parallel | N
+bool Command::splitArguments(SimpleCommand *cmd, const std::vector<char *> &args, bool canSplit,
+                             std::vector<size_t> &cuts, int &jobs) {
+    long argMax = sysconf(_SC_ARG_MAX);
+    if (argMax <= 0) {
+        return true;
+    }
+    size_t fixed = argSlack + 2 * sizeof(char *);
+    for (char **env = Variables::envp(); *env != NULL; env++) {
+        fixed += strlen(*env) + 1 + sizeof(char *);
+    }
+    size_t count = args.size() - 1;
+    std::vector<size_t> sizes(count);
+    size_t total = fixed;
+    for (size_t i = 0; i < count; i++) {
+        sizes[i] = strlen(args[i]) + 1;
+        if (sizes[i] > maxArgLength) {
+            return false;
+        }
+        total += sizes[i] + sizeof(char *);
+    }
+    if (total <= (size_t) argMax) {
+        return true;
+    }
+
+    const char *mode = Variables::get("MYSHELL_ARGSPLIT");
+    size_t first = cmd->_expandedFirst;
+    if (!canSplit || mode == NULL || strcmp(mode, "off") == 0 || strcmp(mode, "0") == 0 ||
+        first == std::string::npos || first == 0 || cmd->_expandedEnd != count) {
+        return false;
+    }
+    jobs = strcmp(mode, "parallel") == 0 ? availableCpus() : std::max(atoi(mode), 1);
+
+    for (size_t i = 0; i < first; i++) {
+        fixed += sizes[i] + sizeof(char *);
+    }
+    size_t used = fixed;
+    size_t start = first;
+    for (size_t i = first; i < count; i++) {
+        size_t cost = sizes[i] + sizeof(char *);
+        if (used + cost > (size_t) argMax) {
+            if (i == start) {
+                return false;
+            }
+            cuts.push_back(i);
+            start = i;
+            used = fixed;
+        }
+        used += cost;
+    }
+    return true;
+}
+
+// Run every batch but the last of an argv cut up by splitArguments, at most
+// jobs at a time. args is left holding the last batch, to be launched like
+// any other command once there is room for it; batches still running then
+// are added to running. failed is set when a batch exits non-zero.
+void Command::launchBatches(std::vector<char *> &args, size_t fixed, const std::vector<size_t> &cuts,
+                            int jobs, const std::string &path, const std::vector<int> &privateFds,
+                            const std::vector<int> &keepFds, std::vector<pid_t> &running,
+                            bool &failed) {
+    std::deque<pid_t> active;
+    size_t start = fixed;
+    for (size_t b = 0; b <= cuts.size(); b++) {
+        while ((int) active.size() >= jobs) {
+            int status;
+            if (waitpid(active.front(), &status, 0) > 0 &&
+                (!WIFEXITED(status) || WEXITSTATUS(status) != 0)) {
+                failed = true;
+            }
+            active.pop_front();
+        }
+
+        size_t stop = b < cuts.size() ? cuts[b] : args.size() - 1;
+        std::vector<char *> batch(args.begin(), args.begin() + fixed);
+        batch.insert(batch.end(), args.begin() + start, args.begin() + stop);
+        batch.push_back(NULL);
+        start = stop;
+        if (b == cuts.size()) {
+            args.swap(batch);
+            break;
+        }
+
+        pid_t pid = launchProcess(batch, path, privateFds, -1, keepFds);
+        if (pid > 0) {
+            active.push_back(pid);
+        } else {
+            failed = true;
+        }
+    }
+    running.insert(running.end(), active.begin(), active.end());
+}
+
+// Start args (args[0] resolved to path) with the shell's current 0/1/2,
+// already redirected by execute(). privateFds are shell-owned descriptors the
+// child must not keep. pgid: -1 stays in the shell's process group, 0 starts
+// a new one, otherwise joins it. keepFds are the stage's own /dev/fd pipes,
+// spared by the close of everything from _firstPrivateFd up. Returns the
+// child's pid, or -1 on failure.
+// args is built by the parent: the vfork child may not allocate.
+pid_t Command::launchProcess(std::vector<char *> &args, const std::string &path,
+                             const std::vector<int> &privateFds, pid_t pgid,
+                             const std::vector<int> &keepFds) {
+    LaunchMode mode = launchMode();
+    char **envp = Variables::envp();
+
+    std::vector<int> spared;
+    for (int fd : keepFds) {
+        if (fd >= Shell::_firstPrivateFd) {
+            spared.push_back(fd);
+        }
+    }
+    std::sort(spared.begin(), spared.end());
+    if (!spared.empty() && mode == LAUNCH_SPAWN) {
+        // closefrom cannot leave holes
+        mode = LAUNCH_FORK;
+    }
+
+    if (mode == LAUNCH_SPAWN) {
+        // posix_spawn uses clone(CLONE_VM|CLONE_VFORK): no page table copy,
+        // however big the shell's heap is
+        posix_spawn_file_actions_t actions;
+        posix_spawn_file_actions_init(&actions);
+        for (int fd : privateFds) {
+            posix_spawn_file_actions_addclose(&actions, fd);
+        }
+#if __GLIBC_PREREQ(2, 34)
+        // anything at 10+ that was not close-on-exec still belongs to the shell
+        posix_spawn_file_actions_addclosefrom_np(&actions, Shell::_firstPrivateFd);
+#endif
+
+        // the child starts without the shell's permanent SIGCHLD block
+        posix_spawnattr_t attr;
+        posix_spawnattr_init(&attr);
+        short flags = POSIX_SPAWN_SETSIGMASK;
+        posix_spawnattr_setsigmask(&attr, &Shell::_childSigmask);
+        if (pgid >= 0) {
+            flags |= POSIX_SPAWN_SETPGROUP;
+            posix_spawnattr_setpgroup(&attr, pgid);
+        }
+        posix_spawnattr_setflags(&attr, flags);
+
+        pid_t pid;
+        int err = posix_spawn(&pid, path.c_str(), &actions, &attr, args.data(), envp);
+        posix_spawn_file_actions_destroy(&actions);
+        posix_spawnattr_destroy(&attr);
+
+        if (err == 0) {
+            // posix_spawn returns once the exec has happened
+            traceInheritedFds(pid, args[0]);
+            return pid;
+        }
+        if (err == ENOENT || err == EACCES || err == ENOEXEC || err == ENOTDIR) {
+            // the exec itself failed, same report as the fork path
+            errno = err;
+            perror("execvp");
+            return -1;
+        }
+        // spawn machinery unavailable (e.g. EAGAIN, ENOSYS): fall back to fork
+        mode = LAUNCH_FORK;
+    }
+
+    bool traceFds = mode == LAUNCH_FORK && Variables::get("MYSHELL_FDTRACE") != NULL;
+    pid_t pid = (mode == LAUNCH_VFORK) ? vfork() : fork();
+    if (pid == 0) {
+        for (int fd : privateFds) {
+            close(fd);
+        }
+        unsigned int from = Shell::_firstPrivateFd;
+        for (int fd : spared) {
+            if ((unsigned int) fd > from) {
+                close_range(from, fd - 1, 0);
+            }
+            from = fd + 1;
+        }
+        close_range(from, ~0U, 0);
+        if (traceFds) {
+            traceOwnFds(args[0], from);
+        }
+        if (pgid >= 0) {
+            setpgid(0, pgid);
+        }
+        sigprocmask(SIG_SETMASK, &Shell::_childSigmask, NULL);
+        execve(path.c_str(), args.data(), envp);
+
+        // a vfork child shares the shell's memory: no stdio, just write
+        const char *errMsg = ": cannot execute\n";
+        write(2, path.c_str(), path.length());
+        write(2, errMsg, strlen(errMsg));
+        _exit(1);
+    } else if (pid < 0) {
+        perror("fork");
+        return -1;
+    }
+    if (pgid >= 0) {
+        // also set from the parent so the group exists before the next stage joins it
+        setpgid(pid, pgid == 0 ? pid : pgid);
+    }
+    if (mode == LAUNCH_VFORK) {
+        // like posix_spawn, the parent only resumes after the exec
+        traceInheritedFds(pid, args[0]);
+    }
+    return pid;
+}
+
+// Relay threads (cat feeders, tee relays) are counted from their start to
+// their end; they live in the shell, so it must not exec or exit under them
+static std::mutex relayMutex;
+static std::condition_variable relayIdle;
+
+static void relayFinished() {
+    std::lock_guard<std::mutex> lock(relayMutex);
+    Command::_liveRelays--;
+    relayIdle.notify_all();
+}
+
+void Command::waitForRelays() {
+    // a forked child has none, and must not touch a mutex copied mid-use
+    if (_liveRelays == 0) {
+        return;
+    }
+    std::unique_lock<std::mutex> lock(relayMutex);
+    relayIdle.wait(lock, [] { return _liveRelays == 0; });
+}
+
+// Feeder thread for an elided "cat a b ...": move each file into the pipe
+// inside the kernel, falling back to read/write where splice can't be used
+static void feedFiles(std::vector<int> fds, int out) {
+    bool failed = false;
+    for (int fd : fds) {
+        ssize_t n = 0;
+        while (!failed && (n = splice(fd, NULL, out, NULL, 1 << 20, SPLICE_F_MOVE)) > 0) {
+        }
+        if (n < 0 && errno == EINVAL) {
+            char buf[65536];
+            while (!failed && (n = read(fd, buf, sizeof(buf))) > 0) {
+                for (ssize_t done = 0; done < n;) {
+                    ssize_t w = write(out, buf + done, n - done);
+                    if (w < 0) {
+                        failed = true;
+                        break;
+                    }
+                    done += w;
+                }
+            }
+        }
+        failed = failed || n < 0;
+        close(fd);
+    }
+    close(out);
+    relayFinished();
+}
+
+// Relay for "> a > b >> c": copy everything read from in to each target.
+// Per round tee() duplicates what is in the pipe into a scratch pipe without
+// consuming it, the scratch copy is tee'd on to the other extra targets, and
+// the last target takes the original bytes with splice. Targets splice
+// cannot write to (O_APPEND files, some devices) get read/write copies.
+// If a scratch pipe or tee() fails, the rest goes through plain read/write.
+static void teeOutput(int in, std::vector<int> targets) {
+    size_t extra = targets.size() - 1;
+    std::vector<int> scratchIn(extra, -1), scratchOut(extra, -1);
+    bool copying = false;  // no tee(): read once, write to every target
+    for (size_t k = 0; k < extra; k++) {
+        int fdpipe[2];
+        if (pipe2(fdpipe, O_CLOEXEC) == -1) {
+            perror("tee: pipe");
+            copying = true;
+            break;
+        }
+        scratchOut[k] = fdpipe[0];
+        scratchIn[k] = fdpipe[1];
+    }
+    std::vector<bool> spliceable(targets.size(), true);
+    std::vector<bool> alive(targets.size(), true);
+
+    // move exactly n bytes out of pipe into target k; a target that fails
+    // is dropped but its share is still consumed so the others keep going
+    auto drain = [&](int pipe, size_t k, size_t n) {
+        while (n > 0) {
+            ssize_t moved;
+            if (alive[k] && spliceable[k]) {
+                moved = splice(pipe, NULL, targets[k], NULL, n, SPLICE_F_MOVE);
+                if (moved < 0 && errno == EINTR) {
+                    continue;
+                }
+                if (moved < 0) {
+                    alive[k] = (errno == EINVAL);
+                    spliceable[k] = false;
+                    continue;
+                }
+            } else {
+                char buf[65536];
+                moved = read(pipe, buf, std::min(n, sizeof(buf)));
+                for (ssize_t done = 0; alive[k] && done < moved;) {
+                    ssize_t w = write(targets[k], buf + done, moved - done);
+                    if (w < 0 && errno != EINTR) {
+                        alive[k] = false;
+                    }
+                    done += std::max(w, (ssize_t)0);
+                }
+            }
+            if (moved <= 0) {
+                break;
+            }
+            n -= moved;
+        }
+    };
+
+    // write n bytes of buf to target k
+    auto put = [&](const char *buf, size_t n, size_t k) {
+        for (size_t done = 0; alive[k] && done < n;) {
+            ssize_t w = write(targets[k], buf + done, n - done);
+            if (w < 0 && errno != EINTR) {
+                alive[k] = false;
+            }
+            done += std::max(w, (ssize_t)0);
+        }
+    };
+
+    char buf[1 << 16];
+    while (!copying) {
+        ssize_t n = tee(in, scratchIn[0], sizeof(buf), 0);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n < 0) {
+            perror("tee");
+            copying = true;
+            break;
+        }
+        if (n == 0) {
+            // the writer closed the pipe and everything was delivered
+            break;
+        }
+        size_t k = 1;
+        ssize_t part = n;
+        while (k < extra && (part = tee(scratchOut[0], scratchIn[k], n, 0)) == n) {
+            k++;
+        }
+        if (k < extra) {
+            // target k and those after it get their copy of this round from
+            // target 0's share instead
+            if (part < 0) {
+                perror("tee");
+            }
+            part = std::max(part, (ssize_t)0);
+            copying = true;
+            ssize_t got = 0;
+            while (got < n) {
+                ssize_t r = read(scratchOut[0], buf + got, n - got);
+                if (r <= 0 && !(r < 0 && errno == EINTR)) {
+                    break;
+                }
+                got += std::max(r, (ssize_t)0);
+            }
+            put(buf, got, 0);
+            for (size_t j = 1; j < k; j++) {
+                drain(scratchOut[j], j, n);
+            }
+            drain(scratchOut[k], k, part);
+            put(buf + part, std::max(got - part, (ssize_t)0), k);
+            for (size_t j = k + 1; j < extra; j++) {
+                put(buf, got, j);
+            }
+        } else {
+            for (size_t j = 0; j < extra; j++) {
+                drain(scratchOut[j], j, n);
+            }
+        }
+        drain(in, extra, n);
+    }
+
+    if (copying) {
+        ssize_t n;
+        while ((n = read(in, buf, sizeof(buf))) > 0 || (n < 0 && errno == EINTR)) {
+            for (size_t k = 0; k < targets.size(); k++) {
+                put(buf, std::max(n, (ssize_t)0), k);
+            }
+        }
+    }
+
+    for (size_t k = 0; k < extra; k++) {
+        close(scratchIn[k]);
+        close(scratchOut[k]);
+    }
+    for (int fd : targets) {
+        close(fd);
+    }
+    close(in);
+}
+
+// Send stdout of the last stage to several files: returns the write end of a
+// pipe whose contents a relay thread fans out to targets.
+// A background job gets a forked relay instead, added to jobPids: the shell
+// may exit or exec long before the job's output has all been copied.
+static int startTee(const std::vector<int> &targets, std::vector<std::thread> &relays,
+                    std::vector<pid_t> *jobPids = NULL) {
+    int fdpipe[2];
+    if (pipe2(fdpipe, O_CLOEXEC) == -1) {
+        return -1;
+    }
+    if (jobPids == NULL) {
+        Command::_liveRelays++;
+        relays.push_back(startRelayThread([](int in, std::vector<int> targets) {
+            teeOutput(in, targets);
+            relayFinished();
+        }, fdpipe[0], targets));
+        return fdpipe[1];
+    }
+
+    // stdio is not flushed: stdout may be pointing into the pipeline by now,
+    // and the relay only writes and leaves with _exit
+    pid_t pid = fork();
+    if (pid == 0) {
+        // like the job itself, the relay is not for ^C at the prompt
+        signal(SIGINT, SIG_IGN);
+        sigset_t pipeSig;
+        sigemptyset(&pipeSig);
+        sigaddset(&pipeSig, SIGPIPE);
+        sigprocmask(SIG_BLOCK, &pipeSig, NULL);
+        close(fdpipe[1]);
+        teeOutput(fdpipe[0], targets);
+        _exit(0);
     }
-    
-    return result.str();
+    close(fdpipe[0]);
+    if (pid < 0) {
+        perror("fork");
+        close(fdpipe[1]);
+        return -1;
+    }
+    for (int fd : targets) {
+        close(fd);
+    }
+    jobPids->push_back(pid);
+    return fdpipe[1];
 }
 
-// check if it's a builtin command
-bool Command::isBuiltInCommand(SimpleCommand *cmd) {
-    if (cmd->_arguments.size() == 0) {
-        return false;
+// A readable descriptor holding a here-document body, without touching the
+// filesystem: a pipe when the body fits in one (so the write cannot block),
+// otherwise an anonymous memfd
+static int hereDocument(const std::string &body) {
+    int fdpipe[2];
+    if (pipe2(fdpipe, O_CLOEXEC) == -1) {
+        return -1;
     }
-    
-    const char *command = cmd->_arguments[0]->c_str();
-    
-    return (strcmp(command, "printenv") == 0 || 
-            strcmp(command, "setenv") == 0 || 
-            strcmp(command, "unsetenv") == 0 || 
-            strcmp(command, "cd") == 0 || 
-            strcmp(command, "source") == 0);
-}
+    int capacity = fcntl(fdpipe[1], F_GETPIPE_SZ);
+    if (capacity > 0 && body.length() <= (size_t)capacity) {
+        write(fdpipe[1], body.data(), body.length());
+        close(fdpipe[1]);
+        return fdpipe[0];
+    }
+    close(fdpipe[0]);
+    close(fdpipe[1]);
 
-// check if it's the printenv command
-bool Command::isPrintEnvCommand(SimpleCommand *cmd) {
-    if (cmd->_arguments.size() == 0) {
-        return false;
+    int fd = memfd_create("here-document", MFD_CLOEXEC);
+    if (fd < 0) {
+        return -1;
     }
-    return (strcmp(cmd->_arguments[0]->c_str(), "printenv") == 0);
+    for (size_t done = 0; done < body.length();) {
+        ssize_t n = write(fd, body.data() + done, body.length() - done);
+        if (n < 0) {
+            close(fd);
+            return -1;
+        }
+        done += n;
+    }
+    lseek(fd, 0, SEEK_SET);
+    return fd;
 }
 
-// execute printenv, printing all environment variables
-void Command::printEnv() {
-    char **env = environ;
-    while (*env) {
-        printf("%s\n", *env);
-        env++;
+// Start one <(cmd) / >(cmd) on a pipe; its other stdio is the shell's own.
+// Returns the shell's end of the pipe (close-on-exec), or -1.
+static int startProcSub(const SimpleCommand::ProcSub &procSub, int tmpin, int tmpout,
+                        int tmperr, pid_t &pgid, std::vector<pid_t> &childPids) {
+    int fdpipe[2];
+    if (pipe2(fdpipe, O_CLOEXEC) == -1) {
+        perror("pipe");
+        return -1;
     }
-    fflush(stdout);  
-}
 
-// setenv
-void Command::setEnv(const char *var, const char *value) {
-    if (setenv(var, value, 1) != 0) { // 1： Overwrite if already existing
-        const char *errMsg = "setenv: Error setting environment variable\n";
-        write(2, errMsg, strlen(errMsg));
+    std::string command = procSub.command;
+    fflush(stdout);
+    fflush(stderr);
+    pid_t pid = fork();
+    if (pid == 0) {
+        if (pgid >= 0) {
+            setpgid(0, pgid);
+        }
+        dup2(procSub.input ? tmpin : fdpipe[0], 0);
+        dup2(procSub.input ? fdpipe[1] : tmpout, 1);
+        dup2(tmperr, 2);
+        close(fdpipe[0]);
+        close(fdpipe[1]);
+        runSubshell(command);
+    } else if (pid < 0) {
+        perror("fork");
+        close(fdpipe[0]);
+        close(fdpipe[1]);
+        return -1;
     }
-}
 
-// unsetenv
-void Command::unsetEnv(const char *var) {
-    if (unsetenv(var) != 0) {
-        const char *errMsg = "unsetenv: Error unsetting environment variable\n";
-        write(2, errMsg, strlen(errMsg));
+    if (pgid >= 0) {
+        setpgid(pid, pgid == 0 ? pid : pgid);
     }
+    if (pgid == 0) {
+        pgid = pid;
+    }
+    // waited for with the pipeline, so >(cmd) output is complete on return
+    childPids.insert(childPids.begin(), pid);
+
+    if (procSub.input) {
+        close(fdpipe[1]);
+        return fdpipe[0];
+    }
+    close(fdpipe[0]);
+    return fdpipe[1];
 }
 
-// cd
-void Command::changeDirectory(const char *dir) {
-    const char *target;
-    
-    if (dir == NULL || strlen(dir) == 0) {
-        // If no directory is specified, default to the home
-        target = getenv("HOME");
-        if (target == NULL) {
-            const char *errMsg = "cd: HOME not set\n";
-            write(2, errMsg, strlen(errMsg));
-            return;
+// "cat f1 [f2 ...] | rest": no need for a cat process. A single file becomes
+// the next stage's stdin, several are fed into the pipe from a thread.
+// Anything cat would treat specially (options, "-", unreadable files, anything
+// but a regular file) keeps the real cat so its behaviour and error messages
+// are unchanged.
+static bool elideCat(SimpleCommand *cmd, int &fdin) {
+    if (*(cmd->_arguments[0]) != "cat" || cmd->_arguments.size() < 2) {
+        return false;
+    }
+
+    std::vector<int> fds;
+    for (size_t i = 1; i < cmd->_arguments.size(); i++) {
+        const std::string &file = *(cmd->_arguments[i]);
+        int fd = -1;
+        if (file[0] != '-') {
+            fd = open(file.c_str(), O_RDONLY | O_CLOEXEC);
         }
-    } else {
-        target = dir;
+        // open() succeeds on a directory; only cat can report it properly
+        struct stat st;
+        if (fd >= 0 && (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode))) {
+            close(fd);
+            fd = -1;
+        }
+        if (fd < 0) {
+            for (int opened : fds) {
+                close(opened);
+            }
+            return false;
+        }
+        fds.push_back(fd);
     }
-    
-    if (chdir(target) != 0) {
-        std::string errMsg = "cd: can't cd to " + std::string(target) + "\n";
-        write(2, errMsg.c_str(), errMsg.length());
+
+    if (fds.size() == 1) {
+        close(fdin);
+        fdin = fds[0];
+        return true;
     }
-}
 
-// source: incorrect yet
-bool Command::sourceFile(const char *filename) {
-    FILE *old_yyin = yyin;  //save old input 
-    FILE *file = fopen(filename, "r");
-    
-    if (!file) {
-        std::string errMsg = "source: can't open " + std::string(filename) + "\n";
-        write(2, errMsg.c_str(), errMsg.length());
+    int fdpipe[2];
+    if (pipe2(fdpipe, O_CLOEXEC) == -1) {
+        for (int fd : fds) {
+            close(fd);
+        }
         return false;
     }
-    
-    // set new input
-    yyin = file;
-    
-    // 解析文件中的命令
-    bool old_tty = Shell::_isTerminal;
-    Shell::_isTerminal = false;  // 在解析脚本文件时禁用终端模式
-    
-    // 临时状态标记
-    bool originalCommandRunning = commandRunning;
-    commandRunning = false;
-    
-    // 执行命令
-    yyparse();
-    
-    // 恢复设置
-    Shell::_isTerminal = old_tty;
-    yyin = old_yyin;
-    fclose(file);
-    
-    // 恢复原始状态标记
-    commandRunning = originalCommandRunning;
-    
+    Command::_liveRelays++;
+    startRelayThread(feedFiles, fds, fdpipe[1]).detach();
+    close(fdin);
+    fdin = fdpipe[0];
     return true;
 }
 
 void Command::execute() {
+    if (_group != NULL && !_redirectError) {
+        executeGroup();
+        return;
+    }
+
     // Don't do anything if there are no simple commands
     if (_simpleCommands.size() == 0 || _redirectError) {
         clear();
@@ -296,42 +2016,118 @@ void Command::execute() {
     // Print contents of Command data structure
     print();
 
+    // pick up background jobs that finished since the last input read
+    Shell::reapChildren();
+    JobTable::prune();
+
+    // whatever the shell printed so far belongs on its own stdout, not on the
+    // redirections and pipes set up below
+    fflush(stdout);
+    fflush(stderr);
+
     // Save standard input, output, and error for restoration later
-    int tmpin = dup(0);
-    int tmpout = dup(1);
-    int tmperr = dup(2);
+    int tmpin = fcntl(0, F_DUPFD_CLOEXEC, Shell::_firstPrivateFd);
+    int tmpout = fcntl(1, F_DUPFD_CLOEXEC, Shell::_firstPrivateFd);
+    int tmperr = fcntl(2, F_DUPFD_CLOEXEC, Shell::_firstPrivateFd);
 
     // Set up redirection for input
     int fdin;
     if (_inFile) {
         // Open input file
-        fdin = open(_inFile->c_str(), O_RDONLY);
+        fdin = open(_inFile->c_str(), O_RDONLY | O_CLOEXEC);
         if (fdin < 0) {
             perror("open infile");
             clear();
             Shell::prompt();
             return;
         }
+    } else if (_hereDoc) {
+        std::string body = _hereDocExpand ? expandEnvironmentVariables(*_hereDoc) : *_hereDoc;
+        fdin = hereDocument(body);
+        if (fdin < 0) {
+            perror("here-document");
+            clear();
+            Shell::prompt();
+            return;
+        }
     } else {
         // Use default input(stdin)
-        fdin = dup(tmpin);
+        fdin = fcntl(tmpin, F_DUPFD_CLOEXEC, 0);
     }
 
     int fdout;
     pid_t pid;
     std::vector<pid_t> childPids; // Save all childPids for later waiting
+    pid_t lastPid = -1;           // the last stage, whose status is the pipeline's
+    bool batched = false;         // argv was split over several execs
+    std::vector<pid_t> batchPids; // batches other than the last one still running
+    bool batchFailed = false;
+    bool keepRedirections = false; // "exec" without a command keeps them
+    pid_t pgid = _background ? 0 : -1; // a background pipeline gets its own process group
+    std::vector<StageTime> stageTimes;  // filled for "time"
+    double timeStart = now();
+
+    // A lone foreground command at the very end of a script has nothing left
+    // to return to: exec it in place instead of fork+wait. Checked while fd 0
+    // is still the shell's own input, not the command's redirected stdin.
+    // Not while a relay thread (this command's "> a > b", or an earlier
+    // job's tee or cat feeder) still has data to copy: the exec would end
+    // it midway.
+    bool tailCall = !_background && !_timed && _simpleCommands.size() == 1 &&
+                    _teeOutFiles.empty() && _liveRelays == 0 &&
+                    !Shell::isTerminal() && _sourceDepth == 0 && lexInputExhausted();
+
+    // "pipestat cmd | cmd ...": relay every link through the shell and report
+    // where the pipeline stalls
+    bool profiled = false;
+    std::vector<std::shared_ptr<LinkStat>> links;
+    std::vector<std::thread> relays;
+    if (!_background && _simpleCommands.size() > 1 &&
+        _simpleCommands[0]->_arguments.size() > 1 &&
+        *(_simpleCommands[0]->_arguments[0]) == "pipestat") {
+        _simpleCommands[0]->removeArgument(0);
+        profiled = true;
+    }
     
+    // this stage's ends of its <(cmd) / >(cmd) pipes, kept until it has started
+    std::vector<int> procSubFds;
+    // what the numbered redirections of the last stage replaced
+    std::vector<std::pair<int, int>> savedFds;
+
     // For each simple command
     for (size_t i = 0; i < _simpleCommands.size(); i++) {
+        for (int fd : procSubFds) {
+            close(fd);
+        }
+        procSubFds.clear();
+
         // environment var expansion
         SimpleCommand *simpleCommand = _simpleCommands[i];
+        simpleCommand->expandBraces();
+        bool selfAppend = isSelfAppend(simpleCommand);
         for (size_t j = 0; j < simpleCommand->_arguments.size(); j++) {
-            // expansion
-            std::string expanded = expandEnvironmentVariables(*(simpleCommand->_arguments[j]));
-            
-            // update arguments
-            delete simpleCommand->_arguments[j];
-            simpleCommand->_arguments[j] = new std::string(expanded);
+            // words were compiled by insertArgument; plain ones stay as they are
+            const SimpleCommand::Word &word = simpleCommand->_words[j];
+            if (!word.literal()) {
+                // for "setenv X ${X}..." only the part after ${X} is needed
+                expandWord(word, *(simpleCommand->_arguments[j]), selfAppend && j == 2 ? 1 : 0);
+            }
+        }
+        expandPathnames(simpleCommand, selfAppend);
+
+        // a leading "cat file..." only feeds the next stage
+        // (not in the background: the feeder thread would tie the shell to the job)
+        if (i == 0 && _simpleCommands.size() > 1 && !_inFile && !_hereDoc && !_timed && !profiled &&
+            !_background && elideCat(simpleCommand, fdin)) {
+            continue;
+        }
+
+        for (auto &procSub : simpleCommand->_procSubs) {
+            int fd = startProcSub(procSub, tmpin, tmpout, tmperr, pgid, childPids);
+            if (fd >= 0) {
+                procSubFds.push_back(fd);
+                *(simpleCommand->_arguments[procSub.index]) = "/dev/fd/" + std::to_string(fd);
+            }
         }
         
         // Redirect input from previous command or input file
@@ -341,7 +2137,7 @@ void Command::execute() {
         // If it's the last command, Setup output redirection
         if (i == _simpleCommands.size() - 1) {
             if (_outFile) {
-                int flags = O_CREAT | O_WRONLY;
+                int flags = O_CREAT | O_WRONLY | O_CLOEXEC;
                 if (_appendOut) {
                     flags |= O_APPEND;
                 } else {
@@ -350,18 +2146,50 @@ void Command::execute() {
                 fdout = open(_outFile->c_str(), flags, 0664);
                 if (fdout < 0) {
                     perror("open outfile");
+                    for (auto &relay : relays) {
+                        relay.detach();
+                    }
                     clear();
                     Shell::prompt();
                     return;
                 }
             } else {
                 // Use default output
-                fdout = dup(tmpout);
+                fdout = fcntl(tmpout, F_DUPFD_CLOEXEC, 0);
+            }
+
+            // "> a > b": fan stdout out to every target from a relay thread
+            if (!_teeOutFiles.empty()) {
+                std::vector<int> targets = {fdout};
+                for (auto &target : _teeOutFiles) {
+                    int flags = O_CREAT | O_WRONLY | O_CLOEXEC | (target.append ? O_APPEND : O_TRUNC);
+                    int fd = open(target.file->c_str(), flags, 0664);
+                    if (fd < 0) {
+                        perror("open outfile");
+                        break;
+                    }
+                    targets.push_back(fd);
+                }
+                fdout = -1;
+                if (targets.size() == _teeOutFiles.size() + 1) {
+                    fdout = startTee(targets, relays, _background ? &childPids : NULL);
+                }
+                if (fdout < 0) {
+                    for (int fd : targets) {
+                        close(fd);
+                    }
+                    for (auto &relay : relays) {
+                        relay.detach();
+                    }
+                    clear();
+                    Shell::prompt();
+                    return;
+                }
             }
 
             // Setup error redirection
             if (_errFile) {
-                int flags = O_CREAT | O_WRONLY;
+                int flags = O_CREAT | O_WRONLY | O_CLOEXEC;
                 if (_appendErr) {
                     flags |= O_APPEND;
                 } else {
@@ -371,6 +2199,9 @@ void Command::execute() {
                 if (fderr < 0) {
                     perror("open errfile");
                     close(fdout);
+                    for (auto &relay : relays) {
+                        relay.detach();
+                    }
                     clear();
                     Shell::prompt();
                     return;
@@ -384,36 +2215,126 @@ void Command::execute() {
         } else {
             // Not the last command - create a pipe
             int fdpipe[2];
-            if (pipe(fdpipe) == -1) {
+            if (pipe2(fdpipe, O_CLOEXEC) == -1) {
                 perror("pipe");
+                for (auto &relay : relays) {
+                    relay.detach();
+                }
                 clear();
                 Shell::prompt();
                 return;
             }
             fdout = fdpipe[1];  //write end
             fdin = fdpipe[0];  //read end
+
+            // pipestat: the stages get separate pipes, the relay owns the inner ends
+            int fdrelay[2];
+            if (profiled && pipe2(fdrelay, O_CLOEXEC) == 0) {
+                std::shared_ptr<LinkStat> link = std::make_shared<LinkStat>();
+                memset(link.get(), 0, sizeof(LinkStat));
+                links.push_back(link);
+                relays.push_back(startRelayThread(relayLink, link, fdpipe[0], fdrelay[1]));
+                fdin = fdrelay[0];
+            }
         }
 
         // Redirect output to fdout
         dup2(fdout, 1);
         close(fdout);
 
+        // then the numbered ones (2>&1, >&3, 3>file ...), left to right
+        if (i == _simpleCommands.size() - 1 && !applyFdRedirects(savedFds)) {
+            _lastReturnCode = 1;
+            continue;
+        }
+
         // Determine if the 1st parameter is "printenv, setenv, unsetenv, cd, source"
         bool isBuiltin = isBuiltInCommand(simpleCommand);
         
+        // A builtin sharing a pipeline with other stages, or sent to the
+        // background, runs in a forked copy of the shell so it cannot block on
+        // a pipe nobody reads yet. Those that change the shell's own state
+        // (or manage its children) stay in the parent.
+        bool builtinInChild = false;
+        if (isBuiltin && (_simpleCommands.size() > 1 || _background) &&
+            !isStateBuiltin(simpleCommand)) {
+            fflush(stdout);
+            fflush(stderr);
+            double launched = now();
+            pid = fork();
+            if (pid == 0) {
+                builtinInChild = true;
+                PathCache::detach();
+                JobTable::clear();
+                _liveRelays = 0;
+                close(tmpin);
+                close(tmpout);
+                close(tmperr);
+                if (i < _simpleCommands.size() - 1) {
+                    close(fdin);
+                }
+                if (pgid >= 0) {
+                    setpgid(0, pgid);
+                }
+                _timed = false;
+            } else {
+                if (pid < 0) {
+                    perror("fork");
+                } else {
+                    if (pgid >= 0) {
+                        setpgid(pid, pgid == 0 ? pid : pgid);
+                    }
+                    childPids.push_back(pid);
+                    if (i == _simpleCommands.size() - 1) {
+                        lastPid = pid;
+                    }
+                    if (pgid == 0) {
+                        pgid = pid;
+                    }
+                    if (_timed) {
+                        StageTime stage;
+                        stage.name = *(simpleCommand->_arguments[0]);
+                        stage.pid = pid;
+                        stage.start = launched;
+                        stage.end = launched;
+                        memset(&stage.usage, 0, sizeof(stage.usage));
+                        stageTimes.push_back(stage);
+                    }
+                }
+                continue;
+            }
+        }
+
         // handle commands
         if (isBuiltin) {
             const char *cmd = simpleCommand->_arguments[0]->c_str();
+            if (_timed) {
+                // a builtin runs in the shell itself: charge it the shell's own usage
+                StageTime stage;
+                stage.name = *(simpleCommand->_arguments[0]);
+                stage.pid = 0;
+                stage.start = now();
+                stage.end = stage.start;
+                getrusage(RUSAGE_SELF, &stage.usage);
+                stageTimes.push_back(stage);
+            }
             
             if (strcmp(cmd, "printenv") == 0) {
                 // printenv: Execute in the parent process
                 printEnv();
                 _lastReturnCode = 0;
             }
+            else if (strcmp(cmd, "((") == 0) {
+                // the argument is the expanded $((expr)), empty after an error
+                const std::string &value = *(simpleCommand->_arguments.back());
+                _lastReturnCode = (value.empty() || value == "0") ? 1 : 0;
+            }
             else if (strcmp(cmd, "setenv") == 0) {
                 if (simpleCommand->_arguments.size() < 3) {
                     const char *errMsg = "setenv: Too few arguments\n";
                     write(2, errMsg, strlen(errMsg));
+                } else if (selfAppend) {
+                    Variables::append(*(simpleCommand->_arguments[1]), *(simpleCommand->_arguments[2]));
                 } else {
                     setEnv(simpleCommand->_arguments[1]->c_str(), simpleCommand->_arguments[2]->c_str());
                 }
@@ -443,57 +2364,276 @@ void Command::execute() {
                 }
                 _lastReturnCode = 0;
             }
+            else if (strcmp(cmd, "hash") == 0) {
+                hashCommand(simpleCommand);
+            }
+            else if (strcmp(cmd, "jobs") == 0) {
+                bool verbose = simpleCommand->_arguments.size() > 1 &&
+                               strcmp(simpleCommand->_arguments[1]->c_str(), "-l") == 0;
+                JobTable::print(verbose);
+                if (verbose && Shell::_initMode) {
+                    printf("init: %lu orphans reaped\n", Shell::_orphansReaped);
+                    fflush(stdout);
+                }
+                _lastReturnCode = 0;
+            }
+            else if (strcmp(cmd, "fg") == 0) {
+                foregroundJob(simpleCommand);
+            }
+            else if (strcmp(cmd, "bg") == 0) {
+                backgroundJob(simpleCommand);
+            }
+            else if (strcmp(cmd, "wait") == 0) {
+                waitCommand(simpleCommand);
+            }
+            else if (strcmp(cmd, "parallel") == 0) {
+                std::vector<int> privateFds = {tmpin, tmpout, tmperr};
+                if (i < _simpleCommands.size() - 1) {
+                    privateFds.push_back(fdin);
+                }
+                parallelCommand(simpleCommand, privateFds);
+            }
+            else if (strcmp(cmd, "exec") == 0) {
+                std::vector<int> privateFds = {tmpin, tmpout, tmperr};
+                if (i < _simpleCommands.size() - 1) {
+                    privateFds.push_back(fdin);
+                }
+
+                if (simpleCommand->_arguments.size() < 2) {
+                    // exec > file: the redirections become the shell's own
+                    keepRedirections = true;
+                    _lastReturnCode = 0;
+                } else {
+                    std::string path;
+                    std::vector<char *> args = simpleCommand->argv(1);
+                    if (!PathCache::lookup(args[0], path)) {
+                        std::string errMsg = "exec: " + std::string(args[0]) + ": not found\n";
+                        write(2, errMsg.c_str(), errMsg.length());
+                        _lastReturnCode = 127;
+                    } else if (_simpleCommands.size() > 1 || _background) {
+                        // inside a pipeline or in the background the stage's own child is replaced
+                        for (int fd : procSubFds) {
+                            fcntl(fd, F_SETFD, 0);
+                        }
+                        pid = launchProcess(args, path, privateFds, pgid, procSubFds);
+                        if (pid > 0) {
+                            childPids.push_back(pid);
+                            if (i == _simpleCommands.size() - 1) {
+                                lastPid = pid;
+                            }
+                            if (pgid == 0) {
+                                pgid = pid;
+                            }
+                        }
+                    } else {
+                        for (int fd : procSubFds) {
+                            fcntl(fd, F_SETFD, 0);
+                        }
+                        execInPlace(args, path, privateFds);
+                        _lastReturnCode = 126;
+                    }
+                }
+            }
+
+            if (_timed) {
+                StageTime &stage = stageTimes.back();
+                struct rusage after;
+                getrusage(RUSAGE_SELF, &after);
+                stage.end = now();
+                timersub(&after.ru_utime, &stage.usage.ru_utime, &stage.usage.ru_utime);
+                timersub(&after.ru_stime, &stage.usage.ru_stime, &stage.usage.ru_stime);
+                stage.usage.ru_maxrss = after.ru_maxrss;
+                stage.usage.ru_nvcsw = after.ru_nvcsw - stage.usage.ru_nvcsw;
+                stage.usage.ru_nivcsw = after.ru_nivcsw - stage.usage.ru_nivcsw;
+            }
+
+            if (builtinInChild) {
+                fflush(stdout);
+                fflush(stderr);
+                _exit(_lastReturnCode);
+            }
         }
         else {
             // common command, execute in child
-            pid = fork();
-            if (pid == 0) {
-                int numArgs = simpleCommand->_arguments.size();
-                char **args = new char*[numArgs + 1];
-                
-                for (int j = 0; j < numArgs; j++) {
-                    args[j] = (char *)simpleCommand->_arguments[j]->c_str();
+            // tmpin/tmpout/tmperr and the next stage's read end belong to the shell
+            std::vector<int> privateFds = {tmpin, tmpout, tmperr};
+            if (i < _simpleCommands.size() - 1) {
+                privateFds.push_back(fdin);
+            }
+
+            // resolve through the lookup cache: an unknown command fails here,
+            // before anything is forked
+            std::string path;
+            if (!PathCache::lookup(*(simpleCommand->_arguments[0]), path)) {
+                std::string errMsg = *(simpleCommand->_arguments[0]) + ": command not found\n";
+                write(2, errMsg.c_str(), errMsg.length());
+                if (i == _simpleCommands.size() - 1) {
+                    _lastReturnCode = 127;
+                }
+                continue;
+            }
+
+            // only the command they were made for inherits the /dev/fd pipes
+            for (int fd : procSubFds) {
+                fcntl(fd, F_SETFD, 0);
+            }
+
+            std::vector<char *> args = simpleCommand->argv();
+
+            // an argv too long for execve fails here rather than after the fork,
+            // unless it may be split over several execs
+            std::vector<size_t> cuts;
+            int jobs = 1;
+            if (!splitArguments(simpleCommand, args, i == _simpleCommands.size() - 1 && !_background,
+                                cuts, jobs)) {
+                std::string errMsg = *(simpleCommand->_arguments[0]) + ": Argument list too long\n";
+                write(2, errMsg.c_str(), errMsg.length());
+                if (i == _simpleCommands.size() - 1) {
+                    _lastReturnCode = 126;
+                }
+                continue;
+            }
+            if (!cuts.empty()) {
+                tailCall = false;
+                batched = true;
+                launchBatches(args, simpleCommand->_expandedFirst, cuts, jobs, path, privateFds,
+                              procSubFds, batchPids, batchFailed);
+                childPids.insert(childPids.end(), batchPids.begin(), batchPids.end());
+            }
+
+            if (tailCall) {
+                execInPlace(args, path, privateFds);
+                _lastReturnCode = 126;
+                continue;
+            }
+
+            double launched = now();
+            pid = launchProcess(args, path, privateFds, pgid, procSubFds);
+            if (pid > 0) {
+                childPids.push_back(pid);
+                if (i == _simpleCommands.size() - 1) {
+                    lastPid = pid;
+                }
+                if (pgid == 0) {
+                    pgid = pid;
                 }
-                args[numArgs] = NULL;
-                
-                execvp(args[0], args);
-                
-                perror("execvp");
-                delete[] args;
-                _exit(1);
-            } else if (pid < 0) {
-                perror("fork");
-                _exit(1);
+                if (_timed) {
+                    StageTime stage;
+                    stage.name = *(simpleCommand->_arguments[0]);
+                    stage.pid = pid;
+                    stage.start = launched;
+                    stage.end = launched;
+                    memset(&stage.usage, 0, sizeof(stage.usage));
+                    stageTimes.push_back(stage);
+                }
+            } else if (i == _simpleCommands.size() - 1) {
+                _lastReturnCode = 1;
             }
-            childPids.push_back(pid);
         }
     }
 
+    for (int fd : procSubFds) {
+        close(fd);
+    }
+    restoreFds(savedFds, keepRedirections);
+
     // Restore stdin, stdout, and stderr
-    dup2(tmpin, 0);
-    dup2(tmpout, 1);
-    dup2(tmperr, 2);
+    if (!keepRedirections) {
+        dup2(tmpin, 0);
+        dup2(tmpout, 1);
+        dup2(tmperr, 2);
+    }
     close(tmpin);
     close(tmpout);
     close(tmperr);
 
     // Wait for commands to finish if not background
     if (!_background) {
-        for (size_t i = 0; i < childPids.size(); i++) {
-            int status;
-            waitpid(childPids[i], &status, 0);
-            
-            if (i == childPids.size() - 1) {
-                if (WIFEXITED(status)) {
-                    _lastReturnCode = WEXITSTATUS(status);
-                } else {
-                    _lastReturnCode = 1;
+        // The pipeline's stages are collected by pid, without blocking, in
+        // the order they finish, which also gives each one its own wall time
+        // for "time". In between the shell sleeps on the signalfd and hands
+        // whatever else finished (background jobs, orphans in init mode) to
+        // the job table.
+        Shell::_foregroundPids = childPids;
+        std::vector<pid_t> pending = childPids;
+        for (;;) {
+            for (size_t k = pending.size(); k-- > 0;) {
+                int status;
+                struct rusage usage;
+                pid_t done = wait4(pending[k], &status, WNOHANG, &usage);
+                if (done == 0 || (done < 0 && errno == EINTR)) {
+                    continue;
+                }
+                pending.erase(pending.begin() + k);
+                if (done < 0) {
+                    continue;
+                }
+
+                for (auto &stage : stageTimes) {
+                    if (stage.pid == done) {
+                        stage.end = now();
+                        stage.usage = usage;
+                    }
                 }
+                if (std::find(batchPids.begin(), batchPids.end(), done) != batchPids.end() &&
+                    (!WIFEXITED(status) || WEXITSTATUS(status) != 0)) {
+                    batchFailed = true;
+                }
+
+                // a last stage that never started (not found, argv too long)
+                // has already set the status
+                if (done == lastPid) {
+                    if (WIFEXITED(status)) {
+                        _lastReturnCode = WEXITSTATUS(status);
+                    } else {
+                        _lastReturnCode = 1;
+                    }
+                }
+            }
+            if (pending.empty()) {
+                break;
+            }
+            Shell::waitForSignals();
+            Shell::reapChildren();
+        }
+
+        Shell::_foregroundPids.clear();
+
+        // a split command fails as a whole, with xargs' status
+        if (batched && (batchFailed || _lastReturnCode != 0)) {
+            _lastReturnCode = 123;
+        }
+
+        if (_timed) {
+            reportTimes(stageTimes, timeStart, now());
+        }
+        for (auto &relay : relays) {
+            relay.join();
+        }
+        if (profiled && links.size() == _simpleCommands.size() - 1) {
+            std::vector<std::string> names;
+            for (SimpleCommand *stage : _simpleCommands) {
+                names.push_back(*(stage->_arguments[0]));
             }
+            reportPipestat(links, names);
+        }
+
+        // init mode: a termination signal was passed on to the pipeline while
+        // it ran; leave now instead of going on with the script
+        if (Shell::_pendingExit) {
+            exit(128 + Shell::_pendingExit);
+        }
+    } else {
+        // pipestat's link relays keep running with the job
+        for (auto &relay : relays) {
+            relay.detach();
+        }
+        if (!childPids.empty()) {
+            _lastBackgroundPid = lastPid > 0 ? lastPid : childPids.back();
+            _lastBackgroundStatus = -1;
+            Job *job = JobTable::add(pgid, childPids, commandLine());
+            printf("[%d] %d\n", job->_id, _lastBackgroundPid);
         }
-    } else if (!childPids.empty()) {
-        _lastBackgroundPid = childPids.back();
-        printf("[%d] %d\n", 1, _lastBackgroundPid);
     }
 
     commandRunning = false;
@@ -502,4 +2642,123 @@ void Command::execute() {
     Shell::prompt();
 }
 
+// { list; } with redirections: they are opened once, on the shell's own
+// descriptors, and the list goes through the parser with them in place
+// instead of every command inside reopening the file
+void Command::executeGroup() {
+    std::string body = *_group + "\n";
+    std::string line = "{" + *_group + "}";
+
+    fflush(stdout);
+    fflush(stderr);
+    int tmpin = fcntl(0, F_DUPFD_CLOEXEC, Shell::_firstPrivateFd);
+    int tmpout = fcntl(1, F_DUPFD_CLOEXEC, Shell::_firstPrivateFd);
+    int tmperr = fcntl(2, F_DUPFD_CLOEXEC, Shell::_firstPrivateFd);
+    std::vector<std::pair<int, int>> savedFds;
+    std::vector<std::thread> relays;
+    std::vector<pid_t> relayPids;
+
+    bool ok = true;
+    int fd = -1;
+    if (_inFile) {
+        fd = open(_inFile->c_str(), O_RDONLY | O_CLOEXEC);
+    } else if (_hereDoc) {
+        fd = hereDocument(_hereDocExpand ? expandEnvironmentVariables(*_hereDoc) : *_hereDoc);
+    }
+    if ((_inFile || _hereDoc) && fd < 0) {
+        perror("open infile");
+        ok = false;
+    } else if (fd >= 0) {
+        dup2(fd, 0);
+        close(fd);
+    }
+
+    if (ok && _outFile) {
+        fd = open(_outFile->c_str(),
+                  O_CREAT | O_WRONLY | O_CLOEXEC | (_appendOut ? O_APPEND : O_TRUNC), 0664);
+        std::vector<int> targets = {fd};
+        for (auto &target : _teeOutFiles) {
+            if (fd >= 0) {
+                int flags = O_CREAT | O_WRONLY | O_CLOEXEC | (target.append ? O_APPEND : O_TRUNC);
+                targets.push_back(open(target.file->c_str(), flags, 0664));
+                fd = targets.back();
+            }
+        }
+        if (fd < 0) {
+            perror("open outfile");
+            for (int target : targets) {
+                close(target);
+            }
+            ok = false;
+        } else {
+            fd = targets.size() > 1 ? startTee(targets, relays, _background ? &relayPids : NULL)
+                                    : targets[0];
+            dup2(fd, 1);
+            close(fd);
+        }
+    }
+
+    if (ok && _errFile) {
+        if (_errFile == _outFile) {
+            dup2(1, 2);
+        } else {
+            fd = open(_errFile->c_str(),
+                      O_CREAT | O_WRONLY | O_CLOEXEC | (_appendErr ? O_APPEND : O_TRUNC), 0664);
+            if (fd < 0) {
+                perror("open errfile");
+                ok = false;
+            } else {
+                dup2(fd, 2);
+                close(fd);
+            }
+        }
+    }
+    ok = ok && applyFdRedirects(savedFds);
+
+    // the commands inside are parsed into this same Command
+    bool background = _background;
+    clear();
+
+    if (ok && background) {
+        fflush(stdout);
+        fflush(stderr);
+        pid_t pid = fork();
+        if (pid == 0) {
+            setpgid(0, 0);
+            close(tmpin);
+            close(tmpout);
+            close(tmperr);
+            runSubshell(body);
+        } else if (pid < 0) {
+            perror("fork");
+        } else {
+            setpgid(pid, pid);
+            _lastBackgroundPid = pid;
+            _lastBackgroundStatus = -1;
+            relayPids.insert(relayPids.begin(), pid);
+            Job *job = JobTable::add(pid, relayPids, line + " &");
+            printf("[%d] %d\n", job->_id, pid);
+        }
+    } else if (ok) {
+        _sourceDepth++;
+        parseString(body);
+        _sourceDepth--;
+    } else {
+        _lastReturnCode = 1;
+    }
+
+    restoreFds(savedFds, false);
+    dup2(tmpin, 0);
+    dup2(tmpout, 1);
+    dup2(tmperr, 2);
+    close(tmpin);
+    close(tmpout);
+    close(tmperr);
+    for (auto &relay : relays) {
+        relay.join();
+    }
+
+    Shell::prompt();
+}
+
 SimpleCommand * Command::_currentSimpleCommand;
@@ -2,6 +2,7 @@
 #define command_hh
 
 #include "simpleCommand.hh"
+#include <atomic>
 #include <vector>
 
 // Command Data Structure
@@ -15,16 +16,38 @@ struct Command {
   bool _appendOut;
   bool _appendErr;
   bool _redirectError;
+  bool _timed;        // "time" prefix: report per-stage usage
+  struct OutTarget {
+    std::string *file;
+    bool append;
+  };
+  std::vector<OutTarget> _teeOutFiles;  // further > / >> targets: stdout is fanned out
+  // N>file, N>>file, N<file, N>&M, N>&- in command-line order
+  struct FdRedirect {
+    int fd;
+    std::string *file;   // file to open on fd, or NULL
+    int flags;           // open flags for file
+    int source;          // without a file: descriptor to duplicate, -1 closes fd
+  };
+  std::vector<FdRedirect> _fdRedirects;
+  std::string *_group;     // body of a { list; }, run as a whole
+  std::string *_hereDoc;   // << or <<< body, read from stdin by the first stage
+  bool _hereDocExpand;     // ${var} expansion applies (delimiter was not quoted)
 
   Command();
   void insertSimpleCommand( SimpleCommand * simpleCommand );
+  void insertFdRedirect(int fd, std::string *file, int flags, std::string *source);
+  static bool isFdWord(const std::string &word);
   void clear();
   void print();
   void execute();
+  void executeGroup();
+  bool applyFdRedirects(std::vector<std::pair<int, int>> &saved);
 
   // 添加内置命令处理函数
   bool isBuiltInCommand(SimpleCommand *cmd);
   bool isPrintEnvCommand(SimpleCommand *cmd);
+  bool isStateBuiltin(SimpleCommand *cmd);
   bool executeBuiltInCommand(SimpleCommand *cmd, bool pipeline);
   
   // 各个内置命令的实现
@@ -34,13 +57,45 @@ struct Command {
   void changeDirectory(const char *dir);
   bool sourceFile(const char *file);
 
+  // 进程启动后端: fork (原始路径), vfork, posix_spawn
+  // selected at runtime through ${MYSHELL_LAUNCH}
+  enum LaunchMode { LAUNCH_FORK, LAUNCH_VFORK, LAUNCH_SPAWN };
+  static LaunchMode launchMode();
+  static pid_t launchProcess(std::vector<char *> &args, const std::string &path,
+                             const std::vector<int> &privateFds, pid_t pgid,
+                             const std::vector<int> &keepFds = std::vector<int>());
+  static void waitForRelays();
+  static void execInPlace(std::vector<char *> &args, const std::string &path,
+                          const std::vector<int> &privateFds);
+  static bool splitArguments(SimpleCommand *cmd, const std::vector<char *> &args, bool canSplit,
+                             std::vector<size_t> &cuts, int &jobs);
+  static void launchBatches(std::vector<char *> &args, size_t fixed, const std::vector<size_t> &cuts,
+                            int jobs, const std::string &path, const std::vector<int> &privateFds,
+                            const std::vector<int> &keepFds, std::vector<pid_t> &running,
+                            bool &failed);
+  void hashCommand(SimpleCommand *cmd);
+  std::string commandLine();
+
+  // 作业控制
+  void foregroundJob(SimpleCommand *cmd);
+  void backgroundJob(SimpleCommand *cmd);
+  void waitCommand(SimpleCommand *cmd);
+  void parallelCommand(SimpleCommand *cmd, const std::vector<int> &privateFds);
+
   // 环境变量扩展功能
   static std::string expandEnvironmentVariables(const std::string &arg);
+  static const char *variableValue(const char *name, size_t length, char (&digits)[24]);
+  static void expandWord(const SimpleCommand::Word &word, std::string &out, size_t first = 0);
+  static bool isSelfAppend(SimpleCommand *cmd);
+  static void expandPathnames(SimpleCommand *cmd, bool selfAppend);
   
   // 特殊环境变量记录
   static pid_t _lastBackgroundPid;
+  static int _lastBackgroundStatus;  // wait status of $! once its job is dropped, -1 before
   static int _lastReturnCode;
   static std::string _lastArgument;
+  static int _sourceDepth;  // >0 while a "source" file is being parsed
+  static std::atomic<int> _liveRelays;  // relay threads still copying; an exec would cut them off
 
   static SimpleCommand *_currentSimpleCommand;
 };
@@ -0,0 +1,385 @@
+#include <algorithm>
+#include <atomic>
+#include <clocale>
+#include <cstring>
+#include <deque>
+#include <iterator>
+#include <mutex>
+#include <thread>
+#include <dirent.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "glob.hh"
+#include "pattern.hh"
+
+std::unordered_map<std::string, Glob::Listing> Glob::_listings;
+int Glob::_threads = 1;
+
+bool Glob::hasWildcard(const std::string &word) {
+    return word.find_first_of("*?[") != std::string::npos;
+}
+
+// Names in a directory ("" is the current one), read on first use.
+// A directory that cannot be read has no names.
+const Glob::Listing &Glob::listing(const std::string &directory) {
+    auto it = _listings.find(directory);
+    if (it != _listings.end()) {
+        return it->second;
+    }
+    Listing &result = _listings[directory];
+    int fd = open(directory.empty() ? "." : directory.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (fd < 0) {
+        return result;
+    }
+
+    // a 1 MiB buffer takes thousands of entries per getdents64 call
+    static std::vector<char> buffer(1 << 20);
+    ssize_t n;
+    while ((n = getdents64(fd, buffer.data(), buffer.size())) > 0) {
+        for (ssize_t pos = 0; pos < n; ) {
+            struct dirent64 *entry = (struct dirent64 *) (buffer.data() + pos);
+            size_t length = strlen(entry->d_name);
+            result.offsets.push_back((uint32_t) result.names.size());
+            result.types.push_back(entry->d_type);
+            result.names.insert(result.names.end(), entry->d_name, entry->d_name + length + 1);
+            pos += entry->d_reclen;
+        }
+    }
+    close(fd);
+    return result;
+}
+
+void Glob::clearCache() {
+    _listings.clear();
+}
+
+// Order the paths by the collation locale. Outside the C locale each path is
+// run through strxfrm once, so the sort compares plain byte strings instead
+// of calling strcoll n log n times.
+void Glob::sort(std::vector<std::string> &paths) {
+    const char *collate = setlocale(LC_COLLATE, NULL);
+    if (collate == NULL || strcmp(collate, "C") == 0 || strcmp(collate, "POSIX") == 0) {
+        std::sort(paths.begin(), paths.end());
+        return;
+    }
+
+    std::string keys;
+    std::vector<std::pair<size_t, size_t>> order;  // key offset, index into paths
+    order.reserve(paths.size());
+    for (size_t i = 0; i < paths.size(); i++) {
+        size_t start = keys.size();
+        size_t length = strxfrm(NULL, paths[i].c_str(), 0);
+        keys.resize(start + length + 1);
+        strxfrm(&keys[start], paths[i].c_str(), length + 1);
+        order.emplace_back(start, i);
+    }
+    std::sort(order.begin(), order.end(), [&](const std::pair<size_t, size_t> &a,
+                                              const std::pair<size_t, size_t> &b) {
+        int c = strcmp(keys.data() + a.first, keys.data() + b.first);
+        return c != 0 ? c < 0 : paths[a.second] < paths[b.second];
+    });
+    std::vector<std::string> sorted;
+    sorted.reserve(paths.size());
+    for (auto &entry : order) {
+        sorted.push_back(std::move(paths[entry.second]));
+    }
+    paths.swap(sorted);
+}
+
+// d_type is DT_UNKNOWN on some filesystems, and a symlink may point at a directory
+static bool isDirectory(const std::string &path, unsigned char type) {
+    if (type == DT_DIR) {
+        return true;
+    }
+    if (type != DT_UNKNOWN && type != DT_LNK) {
+        return false;
+    }
+    struct stat st;
+    return stat(path.c_str(), &st) == 0 && S_ISDIR(st.st_mode);
+}
+
+namespace {
+
+// A symlink to a directory counts where a directory is asked for
+bool isDirectoryAt(int fd, const char *name, unsigned char type) {
+    if (type == DT_DIR) {
+        return true;
+    }
+    struct stat st;
+    return type == DT_LNK && fstatat(fd, name, &st, 0) == 0 && S_ISDIR(st.st_mode);
+}
+
+// One ** walk. Directories are queued as paths relative to an open root and
+// opened with openat, so only the roots' descriptors stay open however wide
+// the tree is. A worker takes from the back of its own queue (depth first,
+// warm dentries) and steals from the front of the others' when it runs dry.
+// Matches are collected per worker and sorted by the caller.
+struct Walker {
+    enum Mode {
+        ALL,          // "dir/**": everything below, and dir/ itself
+        DIRECTORIES,  // "dir/**/": directories below, and dir/ itself
+        MATCH         // "dir/**/x": names matching x in any directory below
+    };
+
+    struct Task {
+        size_t root;
+        std::string path;   // relative to the root: "" or ending in '/'
+    };
+    struct Queue {
+        std::mutex lock;
+        std::deque<Task> tasks;
+    };
+
+    const std::vector<std::string> &roots;
+    std::vector<int> rootFds;
+    Mode mode;
+    Pattern pattern;
+    bool dotted = false;  // the pattern starts with '.', so it may match hidden names
+    bool last = false;    // the pattern is the word's last component
+    std::vector<Queue> queues;
+    std::vector<std::vector<std::string>> results;
+    std::atomic<long> pending{0};   // queued or being visited
+
+    Walker(const std::vector<std::string> &roots, size_t workers)
+        : roots(roots), queues(workers), results(workers) {}
+
+    void push(size_t self, Task task) {
+        pending++;
+        std::lock_guard<std::mutex> guard(queues[self].lock);
+        queues[self].tasks.push_back(std::move(task));
+    }
+
+    bool take(size_t self, Task &task) {
+        for (size_t k = 0; k < queues.size(); k++) {
+            size_t victim = (self + k) % queues.size();
+            std::lock_guard<std::mutex> guard(queues[victim].lock);
+            std::deque<Task> &tasks = queues[victim].tasks;
+            if (tasks.empty()) {
+                continue;
+            }
+            if (k == 0) {
+                task = std::move(tasks.back());
+                tasks.pop_back();
+            } else {
+                task = std::move(tasks.front());
+                tasks.pop_front();
+            }
+            return true;
+        }
+        return false;
+    }
+
+    void run(size_t self) {
+        Task task;
+        for (;;) {
+            if (take(self, task)) {
+                visit(self, task);
+                pending--;
+            } else if (pending == 0) {
+                return;
+            } else {
+                std::this_thread::yield();
+            }
+        }
+    }
+
+    // read one directory, queue its subdirectories and match its names
+    void visit(size_t self, const Task &task) {
+        int fd = openat(rootFds[task.root], task.path.empty() ? "." : task.path.c_str(),
+                        O_RDONLY | O_DIRECTORY | O_CLOEXEC | O_NOFOLLOW);
+        if (fd < 0) {
+            return;
+        }
+        thread_local std::vector<char> buffer(1 << 18);
+        std::string base = roots[task.root] + task.path;
+        std::vector<std::string> &found = results[self];
+        ssize_t n;
+        while ((n = getdents64(fd, buffer.data(), buffer.size())) > 0) {
+            for (ssize_t pos = 0; pos < n; ) {
+                struct dirent64 *entry = (struct dirent64 *) (buffer.data() + pos);
+                pos += entry->d_reclen;
+                const char *name = entry->d_name;
+                if (name[0] == '.' && (name[1] == '\0' || (name[1] == '.' && name[2] == '\0'))) {
+                    continue;
+                }
+                bool hidden = name[0] == '.';
+                unsigned char type = entry->d_type;
+                if (type == DT_UNKNOWN) {
+                    struct stat st;
+                    if (fstatat(fd, name, &st, AT_SYMLINK_NOFOLLOW) == 0) {
+                        type = S_ISDIR(st.st_mode) ? DT_DIR : S_ISLNK(st.st_mode) ? DT_LNK : DT_REG;
+                    }
+                }
+                // ** does not enter hidden directories or follow symlinks
+                if (!hidden && type == DT_DIR) {
+                    push(self, Task{task.root, task.path + name + '/'});
+                }
+
+                switch (mode) {
+                case ALL:
+                    if (!hidden) {
+                        found.push_back(base + name);
+                    }
+                    break;
+                case DIRECTORIES:
+                    if (!hidden && isDirectoryAt(fd, name, type)) {
+                        found.push_back(base + name + '/');
+                    }
+                    break;
+                case MATCH:
+                    if ((hidden && !dotted) || !pattern.match(name, strlen(name))) {
+                        break;
+                    }
+                    if (last) {
+                        found.push_back(base + name);
+                    } else if (isDirectoryAt(fd, name, type)) {
+                        found.push_back(base + name + '/');
+                    }
+                    break;
+                }
+            }
+        }
+        close(fd);
+    }
+};
+
+}  // namespace
+
+// "**" followed by next (NULL when ** ends the word) below every root
+void Glob::walk(const std::vector<std::string> &roots, const std::string *next, bool last,
+                std::vector<std::string> &found) {
+    size_t workers = std::max(_threads, 1);
+    Walker walker(roots, workers);
+    walker.mode = next == NULL ? Walker::ALL : next->empty() && last ? Walker::DIRECTORIES : Walker::MATCH;
+    if (walker.mode == Walker::MATCH) {
+        walker.pattern = Pattern::compile(*next);
+        walker.dotted = !next->empty() && (*next)[0] == '.';
+        walker.last = last;
+    }
+
+    for (size_t i = 0; i < roots.size(); i++) {
+        int fd = open(roots[i].empty() ? "." : roots[i].c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+        walker.rootFds.push_back(fd);
+        if (fd < 0) {
+            continue;
+        }
+        if (walker.mode != Walker::MATCH && !roots[i].empty()) {
+            walker.results[0].push_back(roots[i]);
+        }
+        walker.push(i % workers, Walker::Task{i, ""});
+    }
+
+    std::vector<std::thread> threads;
+    for (size_t i = 1; i < workers; i++) {
+        threads.emplace_back(&Walker::run, &walker, i);
+    }
+    walker.run(0);
+    for (auto &thread : threads) {
+        thread.join();
+    }
+
+    for (int fd : walker.rootFds) {
+        if (fd >= 0) {
+            close(fd);
+        }
+    }
+    for (auto &result : walker.results) {
+        std::move(result.begin(), result.end(), std::back_inserter(found));
+    }
+}
+
+// Expand word one '/' component at a time: literal components are appended
+// without reading anything, wildcard ones are matched against the listing of
+// every directory found so far, and ** walks the trees below them. False when the word has no wildcard
+// component or nothing matches.
+bool Glob::expand(const std::string &word, std::vector<std::string> &matches) {
+    std::vector<std::string> components;
+    for (size_t start = 0; ; ) {
+        size_t slash = word.find('/', start);
+        components.push_back(word.substr(start, slash - start));
+        if (slash == std::string::npos) {
+            break;
+        }
+        start = slash + 1;
+    }
+
+    std::vector<std::string> prefixes(1);
+    std::vector<std::string> next;
+    size_t searched = components.size();  // last wildcard component
+    for (size_t c = 0; c < components.size(); c++) {
+        bool last = c + 1 == components.size();
+        if (components[c] == "**") {
+            // ** and the component after it are matched together by the walk
+            bool hasNext = !last;
+            next.clear();
+            walk(prefixes, hasNext ? &components[c + 1] : NULL, c + 2 == components.size(), next);
+            if (hasNext) {
+                c++;
+            }
+            searched = c;
+            prefixes.swap(next);
+            if (prefixes.empty()) {
+                return false;
+            }
+            continue;
+        }
+        Pattern pattern = Pattern::compile(components[c]);
+        if (pattern._isLiteral) {
+            for (auto &prefix : prefixes) {
+                prefix += pattern._literal;
+                if (!last) {
+                    prefix += '/';
+                }
+            }
+            continue;
+        }
+
+        searched = c;
+        // a leading '.' has to be matched explicitly; . and .. never are
+        bool dotted = components[c][0] == '.';
+        next.clear();
+        for (auto &prefix : prefixes) {
+            const Listing &entries = listing(prefix);
+            for (uint32_t i = 0; i < entries.offsets.size(); i++) {
+                const char *name = entries.names.data() + entries.offsets[i];
+                size_t end = i + 1 < entries.offsets.size() ? entries.offsets[i + 1] : entries.names.size();
+                size_t length = end - entries.offsets[i] - 1;
+                if (name[0] == '.' && (!dotted || length == 1 || (length == 2 && name[1] == '.'))) {
+                    continue;
+                }
+                if (!pattern.match(name, length)) {
+                    continue;
+                }
+                if (!last && !isDirectory(prefix + name, entries.types[i])) {
+                    continue;
+                }
+                std::string path = prefix;
+                path.append(name, length);
+                if (!last) {
+                    path += '/';
+                }
+                next.push_back(std::move(path));
+            }
+        }
+        prefixes.swap(next);
+        if (prefixes.empty()) {
+            return false;
+        }
+    }
+    if (searched == components.size()) {
+        return false;
+    }
+
+    // "*/Makefile": the literal part after the last wildcard still has to exist
+    bool check = searched + 1 < components.size() && !components.back().empty();
+    struct stat st;
+    for (auto &path : prefixes) {
+        if (!check || lstat(path.c_str(), &st) == 0) {
+            matches.push_back(std::move(path));
+        }
+    }
+    sort(matches);
+    return !matches.empty();
+}
@@ -0,0 +1,36 @@
+#ifndef glob_hh
+#define glob_hh
+
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// Pathname expansion of *, ? and [...] in unquoted words.
+// Directories are read with large getdents64 batches, and each listing is
+// kept until the command line has run, so "a/*.c a/*.h" reads a/ once.
+// A "**" component walks the whole tree below it on a thread pool.
+
+struct Glob {
+
+  struct Listing {
+    std::vector<char> names;           // NUL-terminated names back to back
+    std::vector<uint32_t> offsets;     // start of each name in names
+    std::vector<unsigned char> types;  // d_type of each name
+  };
+
+  static bool hasWildcard(const std::string &word);
+  static bool expand(const std::string &word, std::vector<std::string> &matches);
+  static void clearCache();
+
+  static std::unordered_map<std::string, Listing> _listings;  // directory -> names
+  static int _threads;  // workers for a ** walk; 1 walks in the calling thread
+
+private:
+  static const Listing &listing(const std::string &directory);
+  static void sort(std::vector<std::string> &paths);
+  static void walk(const std::vector<std::string> &roots, const std::string *next, bool last,
+                   std::vector<std::string> &found);
+};
+
+#endif
@@ -0,0 +1,182 @@
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <algorithm>
+#include <sys/time.h>
+#include <sys/wait.h>
+
+#include "jobs.hh"
+
+std::unordered_map<int, Job *> JobTable::_byId;
+std::unordered_map<pid_t, Job *> JobTable::_byPid;
+int JobTable::_maxId = 0;
+
+Job *JobTable::add(pid_t pgid, const std::vector<pid_t> &pids, const std::string &commandLine) {
+    Job *job = new Job();
+    job->_id = ++_maxId;
+    job->_pgid = pgid;
+    job->_pids = pids;
+    job->_running = pids.size();
+    job->_stopped = false;
+    job->_notified = false;
+    job->_status = 0;
+    memset(&job->_usage, 0, sizeof(job->_usage));
+    job->_commandLine = commandLine;
+
+    _byId[job->_id] = job;
+    for (pid_t pid : pids) {
+        _byPid[pid] = job;
+    }
+    return job;
+}
+
+Job *JobTable::find(int id) {
+    auto it = _byId.find(id);
+    return it == _byId.end() ? NULL : it->second;
+}
+
+Job *JobTable::findByPid(pid_t pid) {
+    auto it = _byPid.find(pid);
+    return it == _byPid.end() ? NULL : it->second;
+}
+
+// "%n", "%%" / "%+" (current job) or a pid
+Job *JobTable::parseSpec(const char *spec) {
+    if (spec[0] == '%') {
+        if (strcmp(spec, "%%") == 0 || strcmp(spec, "%+") == 0 || spec[1] == '\0') {
+            return current();
+        }
+        return find(atoi(spec + 1));
+    }
+    return findByPid(atoi(spec));
+}
+
+// the most recently started job
+Job *JobTable::current() {
+    Job *latest = NULL;
+    for (auto &item : _byId) {
+        if (latest == NULL || item.first > latest->_id) {
+            latest = item.second;
+        }
+    }
+    return latest;
+}
+
+void JobTable::remove(Job *job) {
+    for (pid_t pid : job->_pids) {
+        // the pid may already belong to a newer job
+        auto it = _byPid.find(pid);
+        if (it != _byPid.end() && it->second == job) {
+            _byPid.erase(it);
+        }
+    }
+    _byId.erase(job->_id);
+    delete job;
+
+    // ids are reused once the highest ones are gone, like other shells
+    _maxId = 0;
+    for (auto &item : _byId) {
+        _maxId = std::max(_maxId, item.first);
+    }
+}
+
+// forget finished jobs the user has already been told about
+void JobTable::prune() {
+    std::vector<Job *> finished;
+    for (auto &item : _byId) {
+        if (item.second->done() && item.second->_notified) {
+            finished.push_back(item.second);
+        }
+    }
+    for (Job *job : finished) {
+        remove(job);
+    }
+}
+
+// a forked copy of the shell has no children of its own: the parent's jobs
+// are not its to list or wait for
+void JobTable::clear() {
+    for (auto &item : _byId) {
+        delete item.second;
+    }
+    _byId.clear();
+    _byPid.clear();
+    _maxId = 0;
+}
+
+// jobs [-l]: -l adds pids and what each job has cost so far
+void JobTable::print(bool verbose) {
+    std::vector<Job *> jobs;
+    for (auto &item : _byId) {
+        jobs.push_back(item.second);
+    }
+    std::sort(jobs.begin(), jobs.end(), [](Job *a, Job *b) { return a->_id < b->_id; });
+
+    Job *cur = current();
+    for (Job *job : jobs) {
+        char state[32];
+        if (!job->done()) {
+            strcpy(state, job->_stopped ? "Stopped" : "Running");
+        } else if (WIFEXITED(job->_status) && WEXITSTATUS(job->_status) == 0) {
+            strcpy(state, "Done");
+        } else if (WIFEXITED(job->_status)) {
+            snprintf(state, sizeof(state), "Exit %d", WEXITSTATUS(job->_status));
+        } else {
+            snprintf(state, sizeof(state), "Signal %d", WTERMSIG(job->_status));
+        }
+
+        if (verbose) {
+            printf("[%d]%c %d %-10s %ld.%03ldu %ld.%03lds %6ldKB  %s\n",
+                   job->_id, job == cur ? '+' : ' ', job->_pgid, state,
+                   (long)job->_usage.ru_utime.tv_sec, (long)job->_usage.ru_utime.tv_usec / 1000,
+                   (long)job->_usage.ru_stime.tv_sec, (long)job->_usage.ru_stime.tv_usec / 1000,
+                   job->_usage.ru_maxrss, job->_commandLine.c_str());
+        } else {
+            printf("[%d]%c %-10s %s\n", job->_id, job == cur ? '+' : ' ', state,
+                   job->_commandLine.c_str());
+        }
+
+        if (job->done()) {
+            job->_notified = true;
+        }
+    }
+    fflush(stdout);
+    prune();
+}
+
+bool JobTable::anyRunning() {
+    for (auto &item : _byId) {
+        if (!item.second->done() && !item.second->_stopped) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// One status change from wait4 (Shell::reapChildren, fg, timed pipelines)
+void JobTable::childStatus(pid_t pid, int status, const struct rusage &usage) {
+    Job *job = findByPid(pid);
+    if (job == NULL) {
+        return;
+    }
+
+    if (WIFSTOPPED(status)) {
+        job->_stopped = true;
+        return;
+    }
+    if (WIFCONTINUED(status)) {
+        job->_stopped = false;
+        return;
+    }
+
+    job->_running--;
+    if (pid == job->_pids.back()) {
+        job->_status = status;
+    }
+
+    timeradd(&job->_usage.ru_utime, &usage.ru_utime, &job->_usage.ru_utime);
+    timeradd(&job->_usage.ru_stime, &usage.ru_stime, &job->_usage.ru_stime);
+    job->_usage.ru_maxrss = std::max(job->_usage.ru_maxrss, usage.ru_maxrss);
+    job->_usage.ru_nvcsw += usage.ru_nvcsw;
+    job->_usage.ru_nivcsw += usage.ru_nivcsw;
+}
@@ -0,0 +1,47 @@
+#ifndef jobs_hh
+#define jobs_hh
+
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include <sys/types.h>
+#include <sys/resource.h>
+
+// Background job table (jobs, fg, bg, wait)
+
+struct Job {
+  int _id;
+  pid_t _pgid;
+  std::vector<pid_t> _pids;
+  int _running;            // processes not reaped yet
+  bool _stopped;
+  bool _notified;          // completion already reported to the user
+  int _status;             // wait status of the last process in the pipeline
+  struct rusage _usage;    // wait4 usage summed over the job's processes
+  std::string _commandLine;
+
+  bool done() { return _running == 0; }
+};
+
+struct JobTable {
+
+  static Job *add(pid_t pgid, const std::vector<pid_t> &pids, const std::string &commandLine);
+  static Job *find(int id);
+  static Job *findByPid(pid_t pid);
+  static Job *parseSpec(const char *spec);
+  static Job *current();
+  static void remove(Job *job);
+  static void prune();
+  static void clear();
+  static void print(bool verbose);
+  static bool anyRunning();
+
+  // called from the reaping path for every status wait4 returns
+  static void childStatus(pid_t pid, int status, const struct rusage &usage);
+
+  static std::unordered_map<int, Job *> _byId;
+  static std::unordered_map<pid_t, Job *> _byPid;
+  static int _maxId;
+};
+
+#endif
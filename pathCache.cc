@@ -0,0 +1,185 @@
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/inotify.h>
+
+#include "pathCache.hh"
+#include "variables.hh"
+
+std::unordered_map<std::string, PathCache::Entry> PathCache::_table;
+std::string PathCache::_pathValue = "";
+std::vector<std::string> PathCache::_dirs;
+std::vector<struct timespec> PathCache::_dirMtimes;
+int PathCache::_inotifyFd = -1;
+bool PathCache::_watching = true;
+
+// Resolve name to an executable path, caching hits and misses.
+// Names containing '/' are not searched, same as execvp.
+bool PathCache::lookup(const std::string &name, std::string &path) {
+    if (name.find('/') != std::string::npos) {
+        path = name;
+        return true;
+    }
+
+    refresh();
+
+    auto it = _table.find(name);
+    if (it == _table.end() || it->second.relative) {
+        if (it == _table.end()) {
+            Entry entry;
+            entry.hits = 0;
+            it = _table.emplace(name, entry).first;
+        }
+        // after a cd the walk through a relative PATH entry may end elsewhere:
+        // such names keep their hit count but are looked up again every time
+        bool cacheable;
+        it->second.path = resolve(name, cacheable);
+        it->second.relative = !cacheable;
+    }
+
+    it->second.hits++;
+    path = it->second.path;
+    return !path.empty();
+}
+
+// Rebuild the table if PATH or one of its directories changed since it was filled
+void PathCache::refresh() {
+    if (isStale()) {
+        invalidate();
+    }
+}
+
+// In a forked child: the inotify descriptor shares its queue with the
+// parent, and events read here would never reach it. Close it and check
+// the directories' mtimes instead, without arming a queue of our own.
+void PathCache::detach() {
+    if (_inotifyFd >= 0) {
+        close(_inotifyFd);
+        _inotifyFd = -1;
+    }
+    _watching = false;
+}
+
+// Drop every entry and re-arm the watches for the current PATH
+void PathCache::invalidate() {
+    _table.clear();
+
+    _pathValue = pathValue();
+    watchPath(_pathValue.c_str());
+}
+
+// PATH as execvp searches it: /bin:/usr/bin when it is unset
+const char *PathCache::pathValue() {
+    const char *value = Variables::get("PATH");
+    return value ? value : "/bin:/usr/bin";
+}
+
+// hash builtin: hit counts and resolved paths
+void PathCache::print() {
+    if (_table.empty()) {
+        printf("hash: hash table empty\n");
+        fflush(stdout);
+        return;
+    }
+
+    printf("hits\tcommand\n");
+    for (auto &item : _table) {
+        if (item.second.path.empty()) {
+            printf("%4lu\t%s (not found)\n", item.second.hits, item.first.c_str());
+        } else {
+            printf("%4lu\t%s\n", item.second.hits, item.second.path.c_str());
+        }
+    }
+    fflush(stdout);
+}
+
+// PATH itself changed, or something was added to / removed from one of its directories
+bool PathCache::isStale() {
+    if (_pathValue != pathValue() || _dirs.empty()) {
+        return true;
+    }
+
+    if (_inotifyFd >= 0) {
+        // one non-blocking read: any pending event means a PATH directory changed
+        char buf[4096];
+        bool changed = false;
+        while (read(_inotifyFd, buf, sizeof(buf)) > 0) {
+            changed = true;
+        }
+        return changed;
+    }
+
+    for (size_t i = 0; i < _dirs.size(); i++) {
+        struct stat st;
+        if (stat(_dirs[i].c_str(), &st) != 0) {
+            st.st_mtim.tv_sec = 0;
+            st.st_mtim.tv_nsec = 0;
+        }
+        if (st.st_mtim.tv_sec != _dirMtimes[i].tv_sec ||
+            st.st_mtim.tv_nsec != _dirMtimes[i].tv_nsec) {
+            return true;
+        }
+    }
+    return false;
+}
+
+void PathCache::watchPath(const char *pathValue) {
+    if (_inotifyFd >= 0) {
+        close(_inotifyFd);
+    }
+    _inotifyFd = _watching ? inotify_init1(IN_NONBLOCK | IN_CLOEXEC) : -1;
+
+    _dirs.clear();
+    _dirMtimes.clear();
+
+    std::string value = pathValue;
+    size_t start = 0;
+    while (start <= value.length()) {
+        size_t end = value.find(':', start);
+        if (end == std::string::npos) {
+            end = value.length();
+        }
+        // an empty PATH element means the current directory
+        std::string dir = value.substr(start, end - start);
+        if (dir.empty()) {
+            dir = ".";
+        }
+        _dirs.push_back(dir);
+
+        struct stat st;
+        if (stat(dir.c_str(), &st) != 0) {
+            st.st_mtim.tv_sec = 0;
+            st.st_mtim.tv_nsec = 0;
+        }
+        _dirMtimes.push_back(st.st_mtim);
+
+        if (_inotifyFd >= 0) {
+            inotify_add_watch(_inotifyFd, dir.c_str(),
+                              IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO |
+                              IN_ATTRIB | IN_DELETE_SELF | IN_MOVE_SELF);
+        }
+        start = end + 1;
+    }
+}
+
+// The PATH walk execvp would do, without the failing execve calls.
+// cacheable is false when a relative entry ("" or ".") was searched before
+// the answer was known: after a cd the same walk may end elsewhere.
+std::string PathCache::resolve(const std::string &name, bool &cacheable) {
+    cacheable = true;
+    for (auto &dir : _dirs) {
+        if (dir[0] != '/') {
+            cacheable = false;
+        }
+        std::string candidate = dir + "/" + name;
+        struct stat st;
+        if (stat(candidate.c_str(), &st) == 0 && S_ISREG(st.st_mode) &&
+            access(candidate.c_str(), X_OK) == 0) {
+            return candidate;
+        }
+    }
+    return "";
+}
@@ -0,0 +1,39 @@
+#ifndef pathcache_hh
+#define pathcache_hh
+
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include <ctime>
+
+// Executable lookup cache: command name -> resolved path (the "hash" builtin)
+
+struct PathCache {
+
+  struct Entry {
+    std::string path;     // empty for a negative entry
+    unsigned long hits;
+    bool relative;        // found through a relative PATH entry: walked every time
+  };
+
+  static bool lookup(const std::string &name, std::string &path);
+  static void refresh();
+  static void invalidate();
+  static void detach();
+  static void print();
+
+  static std::unordered_map<std::string, Entry> _table;
+  static std::string _pathValue;                   // PATH the table was built for
+  static std::vector<std::string> _dirs;
+  static std::vector<struct timespec> _dirMtimes;  // fallback when inotify is unavailable
+  static int _inotifyFd;
+  static bool _watching;                           // false in forked children
+
+private:
+  static const char *pathValue();
+  static bool isStale();
+  static void watchPath(const char *pathValue);
+  static std::string resolve(const std::string &name, bool &cacheable);
+};
+
+#endif
@@ -0,0 +1,149 @@
+#include <cstring>
+
+#include "pattern.hh"
+
+Pattern Pattern::compile(const std::string &text) {
+    Pattern pattern;
+    for (size_t i = 0; i < text.size(); i++) {
+        Token token;
+        token.kind = CHAR;
+        token.c = text[i];
+        token.negated = false;
+        token.set = -1;
+
+        if (text[i] == '\\' && i + 1 < text.size()) {
+            token.c = text[++i];
+        } else if (text[i] == '?') {
+            token.kind = ANY;
+        } else if (text[i] == '*') {
+            if (!pattern._tokens.empty() && pattern._tokens.back().kind == STAR) {
+                continue;  // ** is the same as *
+            }
+            token.kind = STAR;
+        } else if (text[i] == '[') {
+            // [...] with ranges; an unterminated [ is an ordinary character
+            size_t j = i + 1;
+            if (j < text.size() && (text[j] == '!' || text[j] == '^')) {
+                j++;
+            }
+            if (j < text.size() && text[j] == ']') {
+                j++;  // a leading ] is a member
+            }
+            while (j < text.size() && text[j] != ']') {
+                j++;
+            }
+            if (j < text.size()) {
+                token.kind = SET;
+                token.set = (int) pattern._sets.size();
+                pattern._sets.emplace_back();
+                std::bitset<256> &members = pattern._sets.back();
+                size_t k = i + 1;
+                if (text[k] == '!' || text[k] == '^') {
+                    token.negated = true;
+                    k++;
+                }
+                for (; k < j; k++) {
+                    unsigned char from = text[k];
+                    if (k + 2 < j && text[k + 1] == '-') {
+                        unsigned char to = text[k + 2];
+                        for (unsigned c = from; c <= to; c++) {
+                            members.set(c);
+                        }
+                        k += 2;
+                    } else {
+                        members.set(from);
+                    }
+                }
+                i = j;
+            }
+        }
+
+        if (token.kind != CHAR) {
+            pattern._isLiteral = false;
+        }
+        pattern._tokens.push_back(token);
+    }
+
+    if (pattern._isLiteral) {
+        for (auto &token : pattern._tokens) {
+            pattern._literal += token.c;
+        }
+    }
+    return pattern;
+}
+
+// Whole-string match; a * backtracks to the last star only, so this is
+// O(length * tokens) at worst
+bool Pattern::match(const char *s, size_t length) const {
+    if (_isLiteral) {
+        return length == _literal.size() && memcmp(s, _literal.data(), length) == 0;
+    }
+
+    size_t t = 0, i = 0;
+    size_t starToken = (size_t) -1, starPos = 0;
+    while (i < length) {
+        if (t < _tokens.size()) {
+            const Token &token = _tokens[t];
+            bool ok = false;
+            switch (token.kind) {
+            case CHAR:
+                ok = token.c == s[i];
+                break;
+            case ANY:
+                ok = true;
+                break;
+            case SET:
+                ok = _sets[token.set].test((unsigned char) s[i]) != token.negated;
+                break;
+            case STAR:
+                starToken = t++;
+                starPos = i;
+                continue;
+            }
+            if (ok) {
+                t++;
+                i++;
+                continue;
+            }
+        }
+        if (starToken == (size_t) -1) {
+            return false;
+        }
+        // let the last * swallow one more character
+        t = starToken + 1;
+        i = ++starPos;
+    }
+    while (t < _tokens.size() && _tokens[t].kind == STAR) {
+        t++;
+    }
+    return t == _tokens.size();
+}
+
+long Pattern::matchPrefix(const char *s, size_t length, bool longest) const {
+    if (_isLiteral) {
+        bool ok = _literal.size() <= length && memcmp(s, _literal.data(), _literal.size()) == 0;
+        return ok ? (long) _literal.size() : -1;
+    }
+    for (size_t n = 0; n <= length; n++) {
+        size_t k = longest ? length - n : n;
+        if (match(s, k)) {
+            return (long) k;
+        }
+    }
+    return -1;
+}
+
+long Pattern::matchSuffix(const char *s, size_t length, bool longest) const {
+    if (_isLiteral) {
+        bool ok = _literal.size() <= length &&
+                  memcmp(s + length - _literal.size(), _literal.data(), _literal.size()) == 0;
+        return ok ? (long) _literal.size() : -1;
+    }
+    for (size_t n = 0; n <= length; n++) {
+        size_t k = longest ? length - n : n;
+        if (match(s + length - k, k)) {
+            return (long) k;
+        }
+    }
+    return -1;
+}
@@ -0,0 +1,36 @@
+#ifndef pattern_hh
+#define pattern_hh
+
+#include <bitset>
+#include <cstddef>
+#include <string>
+#include <vector>
+
+// A glob pattern (*, ?, [...], \x) compiled once into a token list.
+// Used by the ${v#p} / ${v%p} / ${v/p/r} operators.
+
+struct Pattern {
+
+  enum Kind { CHAR, ANY, STAR, SET };
+
+  struct Token {
+    Kind kind;
+    char c;             // CHAR
+    bool negated;       // SET: [!...] or [^...]
+    int set;            // SET: index into _sets
+  };
+
+  std::vector<Token> _tokens;
+  std::vector<std::bitset<256>> _sets;
+  std::string _literal;   // the whole pattern when it has no wildcard
+  bool _isLiteral = true;
+
+  static Pattern compile(const std::string &text);
+  bool match(const char *s, size_t length) const;
+
+  // length of the shortest / longest prefix or suffix of s that matches, or -1
+  long matchPrefix(const char *s, size_t length, bool longest) const;
+  long matchSuffix(const char *s, size_t length, bool longest) const;
+};
+
+#endif
@@ -1,68 +1,300 @@
 #include <cstdio>
+#include <cerrno>
+#include <clocale>
+#include <cstring>
 #include <signal.h>
 #include <sys/wait.h>
+#include <sys/signalfd.h>
+#include <sys/prctl.h>
+#include <sys/epoll.h>
+#include <poll.h>
+#include <fcntl.h>
 #include <unistd.h>
 #include <string>
+#include <algorithm>
 #include "shell.hh"
+#include "jobs.hh"
+#include "variables.hh"
 
 int yyparse(void);
+extern FILE *yyin;
 
 // global variable: track Whether a command is running
 bool commandRunning = false; //false: no foreground process, shell is idle
 
 bool Shell::promptNeeded = false;
+bool Shell::_isSubshell = false;
 bool Shell::_isTerminal = false;  // 添加静态成员初始化
 std::string Shell::_shellPath = "";  // Shell路径初始化
+int Shell::_signalFd = -1;
+int Shell::_epollFd = -1;
+FILE *Shell::_epollInput = NULL;
+bool Shell::_inputPollable = false;
+FILE *Shell::_endedInput = NULL;
+sigset_t Shell::_childSigmask;
+std::vector<pid_t> Shell::_finished;
+std::vector<pid_t> Shell::_foregroundPids;
+bool Shell::_initMode = false;
+unsigned long Shell::_orphansReaped = 0;
+int Shell::_pendingExit = 0;
 
 // SIGINT handle function (CtrlC)
 void sigintHandler(int sig) {
     // If no command is running, print a new prompt
-    if (!commandRunning) {
-        printf("\n");  // clear current line
-        Shell::prompt();  // new prompt
-        fflush(stdout);
+    if (!commandRunning && isatty(0)) {
+        // write() only: the main loop may be inside stdio right now
+        const char *newPrompt = "\nmyshell>";
+        write(1, newPrompt, strlen(newPrompt));
     }
     // If the command is running, do nothing
     //  let the signal pass to the child process
 }
 
-// SIGCHLD handle function (zombie elimination)
-void sigchldHandler(int sig) {
-    pid_t pid;
+// Drain the signalfd. SIGCHLD needs nothing here (the wait4 loops pick
+// up every child); termination signals exist only in init mode.
+void Shell::handleSignals() {
+    struct signalfd_siginfo info;
+    while (read(_signalFd, &info, sizeof(info)) > 0) {
+        if (info.ssi_signo != SIGCHLD) {
+            forwardSignal(info.ssi_signo);
+        }
+    }
+}
+
+// init mode: pass a termination signal on to every job's process group and
+// to the foreground pipeline, then leave once the shell is idle again
+void Shell::forwardSignal(int sig) {
+    for (auto &item : JobTable::_byId) {
+        if (!item.second->done()) {
+            kill(-item.second->_pgid, sig);
+        }
+    }
+    for (pid_t pid : _foregroundPids) {
+        kill(pid, sig);
+    }
+    _pendingExit = sig;
+}
+
+// sleep until the signalfd has something (a child or a forwarded signal)
+void Shell::waitForSignals() {
+    struct pollfd pfd = { _signalFd, POLLIN, 0 };
+    while (poll(&pfd, 1, -1) < 0 && errno == EINTR) {
+    }
+    handleSignals();
+}
+
+// Collect every child that changed state (zombie elimination).
+// Runs from the input loop once the signalfd reports SIGCHLD, never
+// from signal context. The foreground pipeline's stages are left for
+// execute() to collect by pid.
+void Shell::reapChildren() {
+    handleSignals();
+
     int status;
+    struct rusage usage;
     
     // 使用WNOHANG选项非阻塞等待任何子进程
-    while ((pid = waitpid(-1, &status, WNOHANG)) > 0) {
-      if (Shell::isTerminal()) {
-        printf("[%d] exited.\n", pid);
-        Shell::promptNeeded = true;  // new prompt
+    // waitid only looks; wait4 then takes that child and its rusage for its job
+    for (;;) {
+        siginfo_t info;
+        info.si_pid = 0;
+        if (waitid(P_ALL, 0, &info, WEXITED | WSTOPPED | WCONTINUED | WNOHANG | WNOWAIT) < 0 ||
+            info.si_pid == 0) {
+            break;
+        }
+        if (std::find(_foregroundPids.begin(), _foregroundPids.end(), info.si_pid) !=
+            _foregroundPids.end()) {
+            break;
+        }
+        if (wait4(info.si_pid, &status, WNOHANG | WUNTRACED | WCONTINUED, &usage) <= 0) {
+            break;
+        }
+        childReaped(info.si_pid, status, usage);
+    }
+}
+
+// Record one status change; completions are queued and reported in a batch.
+// A pid no job knows is an orphan re-parented to us (subreaper/PID 1).
+void Shell::childReaped(pid_t pid, int status, const struct rusage &usage) {
+    if (JobTable::findByPid(pid) == NULL) {
+        if (!WIFSTOPPED(status) && !WIFCONTINUED(status)) {
+            _orphansReaped++;
+        }
+        return;
+    }
+
+    JobTable::childStatus(pid, status, usage);
+    if (!WIFSTOPPED(status) && !WIFCONTINUED(status)) {
+        _finished.push_back(pid);
+    }
+}
+
+// print queued completions (terminal only)
+void Shell::reportChildren() {
+    if (isTerminal()) {
+        for (pid_t pid : _finished) {
+            printf("[%d] exited.\n", pid);
+
+            Job *job = JobTable::findByPid(pid);
+            if (job != NULL && job->done()) {
+                job->_notified = true;
+            }
+        }
         fflush(stdout);
-      }
     }
-    
-    if (Shell::promptNeeded) {
-      Shell::prompt();
-      Shell::promptNeeded = false;
+    _finished.clear();
+}
+
+// block until some child changes state (wait builtin)
+void Shell::waitForChildren() {
+    waitForSignals();
+    reapChildren();
+}
+
+// YY_INPUT: wait on the input and the signalfd together. Children that
+// finish while the shell sits at the prompt are reported right away.
+int Shell::readInput(char *buf, int maxSize) {
+    int fd = fileno(yyin);
+
+    if (_pendingExit) {
+        exit(128 + _pendingExit);
+    }
+
+    if (yyin != _epollInput) {
+        // "source" switches yyin; regular files cannot be polled and are read directly
+        if (_epollInput != NULL) {
+            epoll_ctl(_epollFd, EPOLL_CTL_DEL, fileno(_epollInput), NULL);
+        }
+        struct epoll_event event;
+        event.events = EPOLLIN;
+        event.data.fd = fd;
+        _inputPollable = epoll_ctl(_epollFd, EPOLL_CTL_ADD, fd, &event) == 0 ||
+                         (errno == EEXIST && epoll_ctl(_epollFd, EPOLL_CTL_MOD, fd, &event) == 0);
+        _epollInput = yyin;
+    }
+
+    while (_inputPollable) {
+        struct epoll_event events[2];
+        int n = epoll_wait(_epollFd, events, 2, -1);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            break;
+        }
+
+        bool inputReady = false;
+        for (int i = 0; i < n; i++) {
+            if (events[i].data.fd == _signalFd) {
+                reapChildren();
+            } else {
+                inputReady = true;
+            }
+        }
+        if (_pendingExit) {
+            exit(128 + _pendingExit);
+        }
+        if (!_finished.empty()) {
+            if (isTerminal()) {
+                printf("\n");
+            }
+            prompt();
+        }
+        if (inputReady) {
+            break;
+        }
+    }
+
+    // note the end of the input as soon as it is in sight, so the parser can
+    // tell the last command of a script without reading ahead for it
+    ssize_t total = 0;
+    for (;;) {
+        ssize_t n = read(fd, buf + total, maxSize - total);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n == 0) {
+            _endedInput = yyin;
+        }
+        if (n <= 0) {
+            break;
+        }
+        total += n;
+        // a regular file is read on until the buffer is full or the file ends
+        if (_inputPollable || total == maxSize) {
+            break;
+        }
+    }
+    if (total > 0 && _inputPollable) {
+        struct pollfd pfd = { fd, POLLIN, 0 };
+        if (poll(&pfd, 1, 0) == 1 && pfd.revents == POLLHUP) {
+            _endedInput = yyin;
+        }
     }
+    return total;
 }
 
 bool Shell::isTerminal() {
-    return isatty(0);
+    return !_isSubshell && isatty(0);
 }
 
 void Shell::prompt() {
-    if (isatty(0)) {  // print prompt only if input coming from terminal
+    if (Command::_sourceDepth > 0) {
+        // inside a sourced file or a { group }: the prompt comes after it
+        return;
+    }
+    if (isTerminal()) {  // print prompt only if input coming from terminal
         _isTerminal = true;
+        reportChildren();
         printf("myshell>");
         fflush(stdout);
     } else {
         _isTerminal = false;
+        _finished.clear();
+        // nobody is told about finished jobs here, so let prune() drop them;
+        // the status of $! is kept for a later "wait $!"
+        for (auto &item : JobTable::_byId) {
+            Job *job = item.second;
+            if (job->done()) {
+                job->_notified = true;
+                if (job->_pids.back() == Command::_lastBackgroundPid) {
+                    Command::_lastBackgroundStatus = job->_status;
+                }
+            }
+        }
     }
 }
 
+// move a shell-owned descriptor to 10 or above so "exec N>file" cannot clobber it
+int Shell::highFd(int fd) {
+    if (fd < 0) {
+        return fd;
+    }
+    int high = fcntl(fd, F_DUPFD_CLOEXEC, _firstPrivateFd);
+    close(fd);
+    return high;
+}
+
 int main(int argc, char **argv) {
     // Save the filepath to the shell ${SHELL}
     Shell::_shellPath = argv[0];
+
+    // from here on variables live in the shell's own table
+    Variables::import(environ);
+
+    // file name expansion sorts by the user's collation order
+    setlocale(LC_COLLATE, "");
+
+    // init mode for container entrypoints: adopt orphaned grandchildren
+    Shell::_initMode = (getpid() == 1);
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--init") == 0) {
+            Shell::_initMode = true;
+        }
+    }
+    if (Shell::_initMode && prctl(PR_SET_CHILD_SUBREAPER, 1) != 0) {
+        perror("prctl");
+    }
     
     // SIGINT signal handler(Ctrl-C)
     struct sigaction sa;
@@ -75,19 +307,34 @@ int main(int argc, char **argv) {
         exit(1);
     }
 
-    // SIGCHLD signal handeler(zombie elimination)
-    struct sigaction sa_chld;
-    sa_chld.sa_handler = sigchldHandler;  //Assign handler
-    sigemptyset(&sa_chld.sa_mask);
-    sa_chld.sa_flags = 0;  
-    
-    if (sigaction(SIGCHLD, &sa_chld, NULL) == -1) {
-        perror("sigaction for SIGCHLD");
+    // SIGCHLD (zombie elimination): blocked for good and read through a
+    // signalfd in the input loop, so waits in Command::execute never race a handler
+    // in init mode termination signals come the same way, to be forwarded
+    sigset_t chld;
+    sigemptyset(&chld);
+    sigaddset(&chld, SIGCHLD);
+    if (Shell::_initMode) {
+        sigaddset(&chld, SIGTERM);
+        sigaddset(&chld, SIGHUP);
+        sigaddset(&chld, SIGQUIT);
+    }
+    sigprocmask(SIG_BLOCK, &chld, &Shell::_childSigmask);
+
+    Shell::_signalFd = Shell::highFd(signalfd(-1, &chld, SFD_NONBLOCK | SFD_CLOEXEC));
+    Shell::_epollFd = Shell::highFd(epoll_create1(EPOLL_CLOEXEC));
+    if (Shell::_signalFd < 0 || Shell::_epollFd < 0) {
+        perror("signalfd/epoll");
         exit(1);
     }
+    struct epoll_event event;
+    event.events = EPOLLIN;
+    event.data.fd = Shell::_signalFd;
+    epoll_ctl(Shell::_epollFd, EPOLL_CTL_ADD, Shell::_signalFd, &event);
     
     Shell::prompt();
     yyparse();
+    // background jobs may still be fed or fanned out by threads of ours
+    Command::waitForRelays();
     return 0;
 }
 
@@ -2,6 +2,9 @@
 #define shell_hh
 
 #include "command.hh"
+#include <cstdio>
+#include <signal.h>
+#include <sys/resource.h>
 
 
 struct Shell {
@@ -11,7 +14,35 @@ struct Shell {
   static bool promptNeeded;  //标记是否需要显示提示符
   static Command _currentCommand;
   static bool _isTerminal;
+  static bool _isSubshell;   // forked to run <(cmd) / >(cmd): never prompt
   static std::string _shellPath; // 存储Shell可执行文件路径
+
+  // 事件循环: SIGCHLD is blocked and read from a signalfd next to the input
+  static int readInput(char *buf, int maxSize);    // YY_INPUT
+  static void reapChildren();
+  static void childReaped(pid_t pid, int status, const struct rusage &usage);
+  static void reportChildren();
+  static void waitForChildren();
+  static void waitForSignals();
+  static void handleSignals();
+  static void forwardSignal(int sig);
+
+  // descriptors the shell keeps for itself live at 10 and up, close-on-exec
+  static const int _firstPrivateFd = 10;
+  static int highFd(int fd);
+  static int _signalFd;
+  static int _epollFd;
+  static FILE *_epollInput;      // input stream currently registered with _epollFd
+  static bool _inputPollable;    // false for regular files, read directly
+  static FILE *_endedInput;      // input stream known to have nothing left to read
+  static sigset_t _childSigmask; // signal mask children start with
+  static std::vector<pid_t> _finished;  // completions not reported yet
+  static std::vector<pid_t> _foregroundPids;  // pipeline execute() is waiting for
+
+  // init mode (--init or running as PID 1): child subreaper for containers
+  static bool _initMode;
+  static unsigned long _orphansReaped;
+  static int _pendingExit;       // termination signal forwarded, exit when idle
 };
 
 #endif
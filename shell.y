@@ -14,11 +14,15 @@
   std::string *cpp_string;
 }
 
-%token <cpp_string> WORD
-%token NOTOKEN GREAT NEWLINE PIPE LESS TWOGREAT GREATAMPERSAND GREATGREAT GREATGREATAMPERSAND AMPERSAND EXIT
+%token <cpp_string> WORD QWORD PROCSUBIN PROCSUBOUT GROUP ARITHCMD
+%token <cpp_string> IOGREAT IOGREATGREAT IOLESS IOGREATAMPERSAND
+%token NOTOKEN GREAT NEWLINE PIPE LESS TWOGREAT GREATAMPERSAND GREATGREAT GREATGREATAMPERSAND AMPERSAND EXIT TIME
+%token HEREDOC LESSLESSLESS SEMI
+%type <cpp_string> word
 
 %{
 #include <stdio.h>
+#include <fcntl.h>
 #include "shell.hh"
 
 void yyerror(const char * s);
@@ -32,9 +36,10 @@ GOAL:
   Commands
   ;
 
+/* left-recursive: the parser stack stays flat however long the script is */
 Commands:
   Command
-  | Command Commands
+  | Commands Command
   ;
 
 Command: simple_command
@@ -42,12 +47,26 @@ Command: simple_command
 
 simple_command:	
   exit_command
-  |pipe_list iomodifier_list background_opt NEWLINE {
+  | time_opt pipe_list iomodifier_list background_opt separator {
     //printf(" Yacc: Execute command\n");
     Shell::_currentCommand.execute();
   }
+  | GROUP iomodifier_list background_opt separator {
+    // { list; } > file: the list runs once with the redirections in place
+    Shell::_currentCommand._group = $1;
+    Shell::_currentCommand.execute();
+  }
   | NEWLINE 
-  | error NEWLINE { yyerrok; }
+  | error NEWLINE {
+    // drop whatever the bad line had set up (e.g. a here-document)
+    Shell::_currentCommand.clear();
+    yyerrok;
+  }
+  ;
+
+separator:
+  NEWLINE
+  | SEMI
   ;
 
 exit_command:
@@ -56,9 +75,17 @@ exit_command:
       printf("Good bye!!\n");
     }
     
+    Command::waitForRelays();
     exit(0);
   }
 
+time_opt:
+  TIME {
+    Shell::_currentCommand._timed = true;
+  }
+  | /* can be empty */
+  ;
+
 pipe_list:
   command_and_args
   | pipe_list PIPE command_and_args
@@ -81,6 +108,20 @@ argument:
     //printf(" Yacc: insert argument \"%s\"\n", $1->c_str());
     Command::_currentSimpleCommand->insertArgument( $1 );
   }
+  | QWORD {
+    // quoted: kept as one argument, never matched against file names
+    Command::_currentSimpleCommand->insertArgument( $1, true );
+  }
+  | TIME {
+    // "time" is only a keyword in front of a pipeline
+    Command::_currentSimpleCommand->insertArgument( new std::string("time") );
+  }
+  | PROCSUBIN {
+    Command::_currentSimpleCommand->insertProcSub( $1, true );
+  }
+  | PROCSUBOUT {
+    Command::_currentSimpleCommand->insertProcSub( $1, false );
+  }
   ;
 
 command_word:
@@ -89,6 +130,22 @@ command_word:
     Command::_currentSimpleCommand = new SimpleCommand();
     Command::_currentSimpleCommand->insertArgument( $1 );
   }
+  | QWORD {
+    Command::_currentSimpleCommand = new SimpleCommand();
+    Command::_currentSimpleCommand->insertArgument( $1, true );
+  }
+  | ARITHCMD {
+    // (( expr )) is the "((" builtin with $((expr)) as its argument
+    Command::_currentSimpleCommand = new SimpleCommand();
+    Command::_currentSimpleCommand->insertArgument( new std::string("((") );
+    Command::_currentSimpleCommand->insertArgument( new std::string("$((" + *$1 + "))") );
+    delete $1;
+  }
+  ;
+
+word:
+  WORD
+  | QWORD
   ;
 
 iomodifier_list:
@@ -97,17 +154,37 @@ iomodifier_list:
   ;
 
 iomodifier:
-  GREAT WORD {
+  GREAT word {
     if (Shell::_currentCommand._outFile) {
-      fprintf(stderr, "Ambiguous output redirect.\n");
-      Shell::_currentCommand._redirectError = true;  //error flag for multiple redirect
+      // another target: the shell tees stdout to all of them
+      Shell::_currentCommand._teeOutFiles.push_back({$2, false});
     } else {
       //printf(" Yacc: insert output \"%s\"\n", $2->c_str());
       Shell::_currentCommand._outFile = $2;
     }
   }
-  | LESS WORD {
-    if (Shell::_currentCommand._inFile) {
+  | HEREDOC {
+    // the lexer fills the body in once it reaches the end of the line
+    if (Shell::_currentCommand._inFile || Shell::_currentCommand._hereDoc) {
+      fprintf(stderr, "Ambiguous input redirect.\n");
+      Shell::_currentCommand._redirectError = true;
+    } else {
+      Shell::_currentCommand._hereDoc = new std::string();
+    }
+  }
+  | LESSLESSLESS word {
+    if (Shell::_currentCommand._inFile || Shell::_currentCommand._hereDoc) {
+      fprintf(stderr, "Ambiguous input redirect.\n");
+      Shell::_currentCommand._redirectError = true;
+      delete $2;
+    } else {
+      Shell::_currentCommand._hereDoc = $2;
+      Shell::_currentCommand._hereDoc->append("\n");
+      Shell::_currentCommand._hereDocExpand = true;
+    }
+  }
+  | LESS word {
+    if (Shell::_currentCommand._inFile || Shell::_currentCommand._hereDoc) {
       fprintf(stderr, "Ambiguous input redirect.\n");
       Shell::_currentCommand._redirectError = true;  //error flag for multiple redirect
     } else {
@@ -115,7 +192,7 @@ iomodifier:
       Shell::_currentCommand._inFile = $2;
     }
   }
-  | TWOGREAT WORD {
+  | TWOGREAT word {
     if (Shell::_currentCommand._errFile) {
       fprintf(stderr, "Ambiguous error redirect.\n");
       Shell::_currentCommand._redirectError = true;
@@ -124,8 +201,11 @@ iomodifier:
       Shell::_currentCommand._errFile = $2;
     }
   }
-  | GREATAMPERSAND WORD {
-    if (Shell::_currentCommand._outFile || Shell::_currentCommand._errFile) {
+  | GREATAMPERSAND word {
+    if (Command::isFdWord(*$2)) {
+      // >&N, >&-: stdout onto descriptor N, or closed
+      Shell::_currentCommand.insertFdRedirect(1, NULL, 0, $2);
+    } else if (Shell::_currentCommand._outFile || Shell::_currentCommand._errFile) {
       fprintf(stderr, "Ambiguous output/error redirect.\n");
       Shell::_currentCommand._redirectError = true;
     } else {
@@ -134,17 +214,16 @@ iomodifier:
       Shell::_currentCommand._errFile = $2;
     }
   }
-  | GREATGREAT WORD {
+  | GREATGREAT word {
     if (Shell::_currentCommand._outFile) {
-      fprintf(stderr, "Ambiguous output redirect.\n");
-      Shell::_currentCommand._redirectError = true;
+      Shell::_currentCommand._teeOutFiles.push_back({$2, true});
     } else {
       //printf(" Yacc: append output \"%s\"\n", $2->c_str());
       Shell::_currentCommand._outFile = $2;
       Shell::_currentCommand._appendOut = true;
     }
   }
-  | GREATGREATAMPERSAND WORD {
+  | GREATGREATAMPERSAND word {
     if (Shell::_currentCommand._outFile || Shell::_currentCommand._errFile) {
       fprintf(stderr, "Ambiguous output/error redirect.\n");
       Shell::_currentCommand._redirectError = true;
@@ -156,6 +235,28 @@ iomodifier:
       Shell::_currentCommand._appendErr = true;
     }
   }
+  | IOGREAT word {
+    Shell::_currentCommand.insertFdRedirect(atoi($1->c_str()), $2, O_WRONLY | O_CREAT | O_TRUNC, NULL);
+    delete $1;
+  }
+  | IOGREATGREAT word {
+    Shell::_currentCommand.insertFdRedirect(atoi($1->c_str()), $2, O_WRONLY | O_CREAT | O_APPEND, NULL);
+    delete $1;
+  }
+  | IOLESS word {
+    Shell::_currentCommand.insertFdRedirect(atoi($1->c_str()), $2, O_RDONLY, NULL);
+    delete $1;
+  }
+  | IOGREATAMPERSAND word {
+    if (!Command::isFdWord(*$2)) {
+      fprintf(stderr, "%s: bad file descriptor\n", $2->c_str());
+      Shell::_currentCommand._redirectError = true;
+      delete $2;
+    } else {
+      Shell::_currentCommand.insertFdRedirect(atoi($1->c_str()), NULL, 0, $2);
+    }
+    delete $1;
+  }
   ;
 
 background_opt:
@@ -1,6 +1,9 @@
+#include <cctype>
 #include <cstdio>
 #include <cstdlib>
+#include <cstring>
 
+#include <algorithm>
 #include <iostream>
 
 #include "simpleCommand.hh"
@@ -16,9 +19,329 @@ SimpleCommand::~SimpleCommand() {
   }
 }
 
-void SimpleCommand::insertArgument( std::string * argument ) {
+void SimpleCommand::insertArgument( std::string * argument, bool quoted ) {
   // simply add the argument to the vector
   _arguments.push_back(argument);
+  Word word;
+  if (!quoted && Brace::compile(*argument, word.brace)) {
+    // the words it stands for are compiled when the command runs
+    word.braced = true;
+  } else {
+    word = compileWord(*argument);
+    word.quoted = quoted;
+  }
+  _words.push_back(std::move(word));
+}
+
+void SimpleCommand::removeArgument( size_t index ) {
+  delete _arguments[index];
+  _arguments.erase(_arguments.begin() + index);
+  _words.erase(_words.begin() + index);
+}
+
+// One argument becomes several (the file names a pattern matched), inserted
+// in a single pass; later <(cmd) arguments move along with them
+void SimpleCommand::replaceArgument( size_t index, std::vector<std::string> & values ) {
+  *_arguments[index] = std::move(values[0]);
+  std::vector<std::string *> added;
+  added.reserve(values.size() - 1);
+  for (size_t i = 1; i < values.size(); i++) {
+    added.push_back(new std::string(std::move(values[i])));
+  }
+  _arguments.insert(_arguments.begin() + index + 1, added.begin(), added.end());
+  Word name;
+  name.quoted = true;
+  _words[index] = name;
+  _words.insert(_words.begin() + index + 1, added.size(), name);
+  for (auto & procSub : _procSubs) {
+    if (procSub.index > index) {
+      procSub.index += added.size();
+    }
+  }
+
+  if (_expandedFirst != std::string::npos && _expandedEnd > index) {
+    _expandedEnd += added.size();
+  }
+  _expandedFirst = std::min(_expandedFirst, index);
+  _expandedEnd = std::max(_expandedEnd, index + values.size());
+}
+
+// Words with braces become the words they stand for, generated one by one
+// straight into the new argument list. Braces come before ${...} as in sh,
+// so every generated word is compiled as an argument of its own. Words that
+// come out empty are dropped.
+void SimpleCommand::expandBraces() {
+  size_t total = _arguments.size();
+  bool any = false;
+  for (auto & word : _words) {
+    if (word.braced && word.brace._size <= Brace::_maxWords) {
+      total += word.brace._size;
+    }
+    any = any || word.braced;
+  }
+  if (!any) {
+    return;
+  }
+
+  std::vector<std::string *> arguments;
+  std::vector<Word> words;
+  arguments.reserve(total);
+  words.reserve(total);
+  std::vector<size_t> moved(_arguments.size());  // new index of each argument
+  for (size_t j = 0; j < _arguments.size(); j++) {
+    moved[j] = arguments.size();
+    Word & word = _words[j];
+    if (!word.braced || word.brace._size > Brace::_maxWords) {
+      if (word.braced) {
+        fprintf(stderr, "%s: brace expansion too large\n", _arguments[j]->c_str());
+      }
+      arguments.push_back(_arguments[j]);
+      words.push_back(std::move(word));
+      continue;
+    }
+
+    size_t first = arguments.size();
+    for (unsigned long long k = 0; k < word.brace._size; k++) {
+      std::string * text = new std::string();
+      word.brace.generate(k, *text);
+      if (text->empty()) {
+        delete text;
+        continue;
+      }
+      arguments.push_back(text);
+      if (text->find('$') == std::string::npos) {
+        words.emplace_back();
+      } else {
+        words.push_back(compileWord(*text));
+      }
+    }
+    delete _arguments[j];
+    if (arguments.size() > first) {
+      _expandedFirst = std::min(_expandedFirst, first);
+      _expandedEnd = arguments.size();
+    }
+  }
+
+  for (auto & procSub : _procSubs) {
+    procSub.index = moved[procSub.index];
+  }
+  _arguments.swap(arguments);
+  _words.swap(words);
+}
+
+// end of the ${...} starting at text[start], skipping nested references;
+// npos when it is not closed
+static size_t referenceEnd( const std::string & text, size_t start ) {
+  int depth = 0;
+  for (size_t i = start; i < text.size(); i++) {
+    if (text[i] == '$' && i + 1 < text.size() && text[i + 1] == '{') {
+      depth++;
+      i++;
+    } else if (text[i] == '}' && --depth == 0) {
+      return i;
+    }
+  }
+  return std::string::npos;
+}
+
+// last ')' of the $((...)) starting at text[start]; npos when it is not closed
+static size_t arithmeticEnd( const std::string & text, size_t start ) {
+  int depth = 0;
+  for (size_t i = start + 3; i < text.size(); i++) {
+    if (text[i] == '(') {
+      depth++;
+    } else if (text[i] == ')' && depth > 0) {
+      depth--;
+    } else if (text[i] == ')') {
+      return i + 1 < text.size() && text[i + 1] == ')' ? i + 1 : std::string::npos;
+    }
+  }
+  return std::string::npos;
+}
+
+// where the ${...} or $((...)) at text[i] ends, npos if it is not one
+static size_t expansionEnd( const std::string & text, size_t i ) {
+  if (text.compare(i, 2, "${") == 0) {
+    return referenceEnd(text, i);
+  }
+  if (text.compare(i, 3, "$((") == 0) {
+    return arithmeticEnd(text, i);
+  }
+  return std::string::npos;
+}
+
+// first c in text[from, to) outside nested expansions, or to
+static size_t findTopLevel( const std::string & text, size_t from, size_t to, char c ) {
+  for (size_t i = from; i < to; i++) {
+    if (text[i] == '$' && expansionEnd(text, i) != std::string::npos) {
+      size_t end = expansionEnd(text, i);
+      if (end == std::string::npos || end >= to) {
+        return to;
+      }
+      i = end;
+    } else if (text[i] == c) {
+      return i;
+    }
+  }
+  return to;
+}
+
+// Split a word at its ${...} references and $((...)) expressions. One
+// without its closing bracket stays literal, like everything else outside.
+SimpleCommand::Word SimpleCommand::compileWord( const std::string & text ) {
+  Word word;
+  size_t literalStart = 0;
+  size_t i = 0;
+  while ((i = text.find('$', i)) != std::string::npos) {
+    size_t end = expansionEnd(text, i);
+    if (end == std::string::npos) {
+      i++;
+      continue;
+    }
+    if (i > literalStart) {
+      word.spans.push_back({Word::LITERAL, (unsigned) literalStart, (unsigned) (i - literalStart),
+                            false, -1, -1, -1});
+    }
+    if (text[i + 1] == '(') {
+      word.spans.push_back(compileArithmetic(word, text, i + 3, end - 1));
+    } else {
+      word.spans.push_back(compileReference(word, text, i + 2, end));
+    }
+    word.variables++;
+    literalStart = end + 1;
+    i = end + 1;
+  }
+  if (word.variables == 0) {
+    word.spans.clear();
+    return word;
+  }
+  if (literalStart < text.size()) {
+    word.spans.push_back({Word::LITERAL, (unsigned) literalStart, (unsigned) (text.size() - literalStart),
+                          false, -1, -1, -1});
+  }
+  word.text = text;
+  return word;
+}
+
+// An operand word; it keeps its text even when literal
+static int addOperand( SimpleCommand::Word & word, const std::string & text, size_t from, size_t to ) {
+  SimpleCommand::Word operand = SimpleCommand::compileWord(text.substr(from, to - from));
+  if (operand.literal()) {
+    operand.text = text.substr(from, to - from);
+  }
+  word.assigns = word.assigns || operand.assigns;
+  word.operands.push_back(std::move(operand));
+  return (int) word.operands.size() - 1;
+}
+
+// The expression in text[offset, end), parsed now unless it has ${...} in it
+SimpleCommand::Word::Span SimpleCommand::compileArithmetic( Word & word, const std::string & text,
+                                                            size_t offset, size_t end ) {
+  Word::Span span = {Word::ARITHMETIC, (unsigned) offset, (unsigned) (end - offset), false, -1, -1, -1};
+  span.operand = addOperand(word, text, offset, end);
+  const Word & operand = word.operands[span.operand];
+  if (operand.spans.empty()) {
+    word.expressions.push_back(Arithmetic::compile(operand.text));
+    span.compiled = (int) word.expressions.size() - 1;
+    word.assigns = word.assigns || word.expressions.back()._assigns;
+  } else {
+    word.assigns = true;
+  }
+  return span;
+}
+
+// The reference in text[offset, end): its variable name, operator and operand
+// words. Anything not understood is a plain variable named by the whole text.
+SimpleCommand::Word::Span SimpleCommand::compileReference( Word & word, const std::string & text,
+                                                           size_t offset, size_t end ) {
+  Word::Span span = {Word::VARIABLE, (unsigned) offset, (unsigned) (end - offset), false, -1, -1, -1};
+
+  size_t name = offset;
+  if (text[name] == '#' && name + 1 < end) {
+    // ${#name}
+    span.op = Word::LENGTH;
+    name++;
+  }
+  size_t nameEnd = name;
+  if (nameEnd < end && strchr("$?!", text[nameEnd])) {
+    nameEnd++;
+  } else {
+    while (nameEnd < end && (isalnum((unsigned char) text[nameEnd]) || text[nameEnd] == '_')) {
+      nameEnd++;
+    }
+  }
+  if (nameEnd == name || (span.op == Word::LENGTH && nameEnd != end)) {
+    span.op = Word::VARIABLE;
+    return span;
+  }
+  span.offset = (unsigned) name;
+  span.length = (unsigned) (nameEnd - name);
+  if (nameEnd == end) {
+    return span;
+  }
+
+  size_t op = nameEnd;
+  if (text[op] == ':' && op + 1 < end && strchr("-=+", text[op + 1])) {
+    span.flag = true;
+    op++;
+  }
+  switch (text[op]) {
+  case '-':
+  case '=':
+  case '+':
+    span.op = text[op] == '-' ? Word::DEFAULT : text[op] == '=' ? Word::ASSIGN : Word::ALTERNATE;
+    span.operand = addOperand(word, text, op + 1, end);
+    word.assigns = word.assigns || span.op == Word::ASSIGN;
+    return span;
+  case '#':
+  case '%':
+  case '/': {
+    span.op = text[op] == '#' ? Word::PREFIX : text[op] == '%' ? Word::SUFFIX : Word::REPLACE;
+    size_t pattern = op + 1;
+    if (pattern < end && text[pattern] == text[op]) {
+      span.flag = true;
+      pattern++;
+    }
+    size_t patternEnd = span.op == Word::REPLACE ? findTopLevel(text, pattern, end, '/') : end;
+    span.operand = addOperand(word, text, pattern, patternEnd);
+    if (patternEnd < end) {
+      span.operand2 = addOperand(word, text, patternEnd + 1, end);
+    }
+    if (word.operands[span.operand].spans.empty()) {
+      word.patterns.push_back(Pattern::compile(word.operands[span.operand].text));
+      span.compiled = (int) word.patterns.size() - 1;
+    }
+    return span;
+  }
+  case ':': {
+    span.op = Word::SUBSTRING;
+    size_t colon = findTopLevel(text, op + 1, end, ':');
+    span.operand = addOperand(word, text, op + 1, colon);
+    if (colon < end) {
+      span.operand2 = addOperand(word, text, colon + 1, end);
+    }
+    return span;
+  }
+  }
+
+  // not an operator: the whole text names the variable, as it always did
+  span.offset = (unsigned) offset;
+  span.length = (unsigned) (end - offset);
+  return span;
+}
+
+// The argument keeps the original text until execute() starts the command
+void SimpleCommand::insertProcSub( std::string * command, bool input ) {
+  ProcSub procSub;
+  procSub.index = _arguments.size();
+  procSub.command = *command;
+  procSub.input = input;
+  _procSubs.push_back(procSub);
+
+  _arguments.push_back(new std::string((input ? "<(" : ">(") + *command + ")"));
+  _words.push_back(Word());
+  _words.back().quoted = true;
+  delete command;
 }
 
 // Print out the simple command
@@ -29,3 +352,13 @@ void SimpleCommand::print() {
   // effectively the same as printf("\n\n");
   std::cout << std::endl;
 }
+
+// NULL-terminated argument vector for exec, starting at argument "first"
+std::vector<char *> SimpleCommand::argv( size_t first ) {
+  std::vector<char *> args;
+  for (size_t i = first; i < _arguments.size(); i++) {
+    args.push_back((char *)_arguments[i]->c_str());
+  }
+  args.push_back(NULL);
+  return args;
+}
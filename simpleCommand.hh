@@ -4,15 +4,83 @@
 #include <string>
 #include <vector>
 
+#include "arithmetic.hh"
+#include "brace.hh"
+#include "pattern.hh"
+
 struct SimpleCommand {
 
   // Simple command is simply a vector of strings
   std::vector<std::string *> _arguments;
 
+  // <(cmd) / >(cmd) arguments, replaced by /dev/fd/N when the command runs
+  struct ProcSub {
+    size_t index;          // position in _arguments
+    std::string command;
+    bool input;            // <(cmd): the command's output is read from /dev/fd/N
+  };
+  std::vector<ProcSub> _procSubs;
+
+  // A word compiled once when it is inserted: literal spans of its text and
+  // the ${...} references between them. Words without any reference have
+  // no spans and are never touched again.
+  struct Word {
+    enum Op {
+      LITERAL,             // text[offset, offset + length)
+      VARIABLE,            // ${name}
+      LENGTH,              // ${#name}
+      DEFAULT,             // ${name-word}, ${name:-word}
+      ASSIGN,              // ${name=word}, ${name:=word}
+      ALTERNATE,           // ${name+word}, ${name:+word}
+      PREFIX,              // ${name#pattern}, ${name##pattern}
+      SUFFIX,              // ${name%pattern}, ${name%%pattern}
+      REPLACE,             // ${name/pattern/string}, ${name//pattern/string}
+      SUBSTRING,           // ${name:offset}, ${name:offset:length}
+      ARITHMETIC           // $((expression)); the expression is operand
+    };
+    struct Span {
+      Op op;
+      unsigned offset;     // the literal text, or the variable name
+      unsigned length;
+      bool flag;           // ":" form of -, =, +; ##, %% and // for the others
+      int operand;         // index into operands, -1 if none
+      int operand2;        // REPLACE string, SUBSTRING length
+      int compiled;        // index into patterns / expressions when the operand is literal
+    };
+    std::string text;      // original text, kept only when there are spans
+    std::vector<Span> spans;
+    std::vector<Word> operands;      // words inside references, expanded on use
+    std::vector<Pattern> patterns;   // patterns compiled along with the word
+    std::vector<Arithmetic> expressions;
+    size_t variables = 0;
+    bool assigns = false;  // contains ${name:=word}, which changes variables
+    bool quoted = false;   // "..." or \x: never expanded to file names
+    bool braced = false;   // has {a,b} or {x..y}: brace stands for the words
+    Brace brace;
+    bool literal() const { return spans.empty(); }
+  };
+  std::vector<Word> _words;  // parallel to _arguments
+
+  // arguments [_expandedFirst, _expandedEnd) came from braces or file name
+  // patterns; only those are spread over several execs when argv is too long
+  size_t _expandedFirst = std::string::npos;
+  size_t _expandedEnd = 0;
+
+  static Word compileWord( const std::string & text );
+  static Word::Span compileReference( Word & word, const std::string & text,
+                                      size_t offset, size_t end );
+  static Word::Span compileArithmetic( Word & word, const std::string & text,
+                                       size_t offset, size_t end );
+
   SimpleCommand();
   ~SimpleCommand();
-  void insertArgument( std::string * argument );
+  void insertArgument( std::string * argument, bool quoted = false );
+  void insertProcSub( std::string * command, bool input );
+  void removeArgument( size_t index );
+  void replaceArgument( size_t index, std::vector<std::string> & values );
+  void expandBraces();
   void print();
+  std::vector<char *> argv( size_t first = 0 );
 };
 
 #endif
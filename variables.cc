@@ -0,0 +1,233 @@
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#include "variables.hh"
+
+std::vector<Variables::Entry> Variables::_entries;
+std::vector<int32_t> Variables::_slots;
+size_t Variables::_removed = 0;
+unsigned long Variables::_generation = 1;
+unsigned long Variables::_envpGeneration = 0;
+std::vector<std::string> Variables::_envStrings;
+std::vector<char *> Variables::_envp;
+
+// Take over the environment the shell was started with
+void Variables::import(char **envp) {
+    rehash(64);
+    for (char **env = envp; *env; env++) {
+        const char *equals = strchr(*env, '=');
+        if (equals == NULL) {
+            continue;
+        }
+        set(std::string(*env, equals - *env), std::string(equals + 1));
+    }
+}
+
+// FNV-1a
+uint32_t Variables::hash(const char *name, size_t length) {
+    uint32_t h = 2166136261u;
+    for (size_t i = 0; i < length; i++) {
+        h = (h ^ (unsigned char) name[i]) * 16777619u;
+    }
+    return h;
+}
+
+// Index of the entry for name (live or removed), or -1
+int32_t Variables::find(const char *name, size_t length, uint32_t h) {
+    if (_slots.empty()) {
+        return -1;
+    }
+    size_t mask = _slots.size() - 1;
+    for (size_t i = h & mask; ; i = (i + 1) & mask) {
+        int32_t index = _slots[i];
+        if (index < 0) {
+            return -1;
+        }
+        Entry &entry = _entries[index];
+        if (entry.hash == h && entry.name.size() == length &&
+            memcmp(entry.name.data(), name, length) == 0) {
+            return index;
+        }
+    }
+}
+
+// Rebuild the table at the given power-of-two capacity, dropping removed entries
+void Variables::rehash(size_t capacity) {
+    if (_removed > 0) {
+        std::vector<Entry> live;
+        live.reserve(_entries.size() - _removed);
+        for (auto &entry : _entries) {
+            if (!entry.removed) {
+                live.push_back(std::move(entry));
+            }
+        }
+        _entries.swap(live);
+        _removed = 0;
+    }
+
+    _slots.assign(capacity, -1);
+    size_t mask = capacity - 1;
+    for (size_t index = 0; index < _entries.size(); index++) {
+        size_t i = _entries[index].hash & mask;
+        while (_slots[i] >= 0) {
+            i = (i + 1) & mask;
+        }
+        _slots[i] = (int32_t) index;
+    }
+}
+
+// New entry at the end; the table is kept at most half full
+Variables::Entry &Variables::insert(const std::string &name, uint32_t h) {
+    if ((_entries.size() + 1) * 2 > _slots.size()) {
+        size_t live = _entries.size() - _removed + 1;
+        size_t capacity = 64;
+        while (live * 2 > capacity) {
+            capacity *= 2;
+        }
+        rehash(capacity);
+    }
+
+    size_t mask = _slots.size() - 1;
+    size_t i = h & mask;
+    while (_slots[i] >= 0) {
+        i = (i + 1) & mask;
+    }
+    _slots[i] = (int32_t) _entries.size();
+
+    Entry entry;
+    entry.name = name;
+    entry.hash = h;
+    entry.removed = false;
+    entry.hasInteger = false;
+    _entries.push_back(std::move(entry));
+    return _entries.back();
+}
+
+const std::string *Variables::lookup(const char *name, size_t length) {
+    int32_t index = find(name, length, hash(name, length));
+    if (index < 0 || _entries[index].removed) {
+        return NULL;
+    }
+    return &_entries[index].value;
+}
+
+// getenv() over the shell's table
+const char *Variables::get(const char *name) {
+    const std::string *value = lookup(name, strlen(name));
+    return value ? value->c_str() : NULL;
+}
+
+void Variables::set(const std::string &name, const std::string &value) {
+    uint32_t h = hash(name.data(), name.size());
+    int32_t index = find(name.data(), name.size(), h);
+    Entry &entry = index >= 0 ? _entries[index] : insert(name, h);
+    if (entry.removed) {
+        entry.removed = false;
+        _removed--;
+    }
+    entry.value = value;
+    entry.hasInteger = false;
+    _generation++;
+}
+
+// "setenv X ${X}suffix" without copying X: amortised O(length of suffix)
+void Variables::append(const std::string &name, const std::string &suffix) {
+    uint32_t h = hash(name.data(), name.size());
+    int32_t index = find(name.data(), name.size(), h);
+    if (index < 0 || _entries[index].removed) {
+        set(name, suffix);
+        return;
+    }
+    Entry &entry = _entries[index];
+    entry.value += suffix;
+    entry.hasInteger = false;
+    _generation++;
+}
+
+void Variables::unset(const std::string &name) {
+    int32_t index = find(name.data(), name.size(), hash(name.data(), name.size()));
+    if (index < 0 || _entries[index].removed) {
+        return;
+    }
+    Entry &entry = _entries[index];
+    entry.removed = true;
+    entry.hasInteger = false;
+    entry.value.clear();
+    entry.value.shrink_to_fit();
+    _removed++;
+    _generation++;
+}
+
+// Value as an integer for arithmetic: unset or empty is 0. The parsed form is
+// kept with the entry, so a counter is not re-parsed on every use.
+bool Variables::integer(const std::string &name, long long &value, std::string &error) {
+    int32_t index = find(name.data(), name.size(), hash(name.data(), name.size()));
+    if (index < 0 || _entries[index].removed) {
+        value = 0;
+        return true;
+    }
+    Entry &entry = _entries[index];
+    if (!entry.hasInteger) {
+        const char *start = entry.value.c_str();
+        char *end;
+        errno = 0;
+        long long parsed = strtoll(start, &end, 0);
+        while (*end == ' ' || *end == '\t') {
+            end++;
+        }
+        if (*end != '\0' || errno == ERANGE) {
+            error = name + ": \"" + entry.value + "\" is not an integer";
+            return false;
+        }
+        entry.integer = parsed;
+        entry.hasInteger = true;
+    }
+    value = entry.integer;
+    return true;
+}
+
+void Variables::setInteger(const std::string &name, long long value) {
+    char digits[24];
+    snprintf(digits, sizeof(digits), "%lld", value);
+    set(name, digits);
+    int32_t index = find(name.data(), name.size(), hash(name.data(), name.size()));
+    _entries[index].integer = value;
+    _entries[index].hasInteger = true;
+}
+
+// NULL-terminated "name=value" array of the variables
+char **Variables::envp() {
+    if (_envpGeneration != _generation) {
+        _envStrings.clear();
+        for (auto &entry : _entries) {
+            if (!entry.removed) {
+                std::string line;
+                line.reserve(entry.name.size() + 1 + entry.value.size());
+                line.append(entry.name).append(1, '=').append(entry.value);
+                _envStrings.push_back(std::move(line));
+            }
+        }
+        _envp.clear();
+        for (auto &line : _envStrings) {
+            _envp.push_back((char *) line.c_str());
+        }
+        _envp.push_back(NULL);
+        _envpGeneration = _generation;
+    }
+    return _envp.data();
+}
+
+// printenv
+void Variables::print() {
+    for (auto &entry : _entries) {
+        if (!entry.removed) {
+            fwrite(entry.name.data(), 1, entry.name.size(), stdout);
+            putchar('=');
+            fwrite(entry.value.data(), 1, entry.value.size(), stdout);
+            putchar('\n');
+        }
+    }
+    fflush(stdout);
+}
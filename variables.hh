@@ -0,0 +1,52 @@
+#ifndef variables_hh
+#define variables_hh
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// Shell variables, owned by the shell instead of libc's environ.
+// Entries are kept in insertion order (what printenv shows) and indexed by an
+// open-addressing table; the envp array for children is rebuilt only when the
+// generation counter has moved since the last build.
+
+struct Variables {
+
+  struct Entry {
+    std::string name;
+    std::string value;
+    uint32_t hash;
+    bool removed;      // unset; the slot is reused if the name comes back
+    bool hasInteger;   // integer caches value for arithmetic
+    long long integer;
+  };
+
+  static void import(char **envp);
+  static const std::string *lookup(const char *name, size_t length);
+  static const char *get(const char *name);
+  static void set(const std::string &name, const std::string &value);
+  static void append(const std::string &name, const std::string &suffix);
+  static void unset(const std::string &name);
+  static bool integer(const std::string &name, long long &value, std::string &error);
+  static void setInteger(const std::string &name, long long value);
+  static char **envp();
+  static void print();
+
+  static std::vector<Entry> _entries;
+  static std::vector<int32_t> _slots;    // index into _entries, -1 when free
+  static size_t _removed;
+  static unsigned long _generation;      // bumped by every change
+
+  static unsigned long _envpGeneration;  // generation _envp was built for
+  static std::vector<std::string> _envStrings;
+  static std::vector<char *> _envp;
+
+private:
+  static uint32_t hash(const char *name, size_t length);
+  static int32_t find(const char *name, size_t length, uint32_t hash);
+  static Entry &insert(const std::string &name, uint32_t hash);
+  static void rehash(size_t capacity);
+};
+
+#endif